@@ -6,12 +6,11 @@
 #include "../src/vector.h"
 #include "../src/miscobj.h"
 #include "../src/textures.h"
-#include "../src/object.h"
-#include "../src/quadric.h"
 #include <string.h>
 
 void sphereflake(FP radius, Point center, int level, Vector up, Vector mark, Boolean bottom);
 void writeheader(void);
+void writesphere(Point center, FP ra);
 
 
 FP scale;
@@ -20,8 +19,6 @@ Vector vector, vector1;
 Point point, point1;
 Color color;
 Surface surface;
-Sphere sphere;
-Texture *textptr[1];
 ofstream f1;
 char filename[130], bufs[130];
 
@@ -59,8 +56,8 @@ int main(int argc, char *argv[])
 	point.init(0,-256.0,0);	// The sphere center
 	color.init(0,0,1);
 	surface.init(0, 1.0, 0, 0, 1, color);
-	sphere.init(surface, point, 64.0);
-	f1 << "1\n" << sphere;	// Write out the original sphere
+	f1 << "252\n" << surface;	// Material 1, which every sphere uses
+	writesphere(point, 64.0);	// Write out the original sphere
 	if (depth > 0)
 		sphereflake(64.0, point, 1, vector, vector1, true);
 	f1 << "-1\n-1\n-1\n";
@@ -88,8 +85,7 @@ void sphereflake(FP radius, Point center, int level, Vector up, Vector mark, Boo
 		theta = (FP)q * 60.0 * DTOR;	// Convert degrees to radians
 		vector = rotate(up, mark, theta);
 		point = VtoP(center + (vector * (radius + radius * scale)));
-		sphere.init(surface, point, radius * scale);
-		f1 << "1\n" << sphere;	// Write out a subsphere
+		writesphere(point, radius * scale);	// Write out a subsphere
 		numberOfObjects++;
 		if (level < depth)
 			sphereflake(radius * scale, point, level+1, vector, up, false);
@@ -101,8 +97,7 @@ void sphereflake(FP radius, Point center, int level, Vector up, Vector mark, Boo
 		theta = ((FP)q * 120.0 + 60.0) * DTOR;
 		vector = rotate(up, vector1, theta);
 		point = VtoP(center + (vector * (radius + radius * scale)));
-		sphere.init(surface, point, radius * scale);
-		f1 << "1\n" << sphere;	// Write out a subsphere
+		writesphere(point, radius * scale);	// Write out a subsphere
 		numberOfObjects++;
 		point1 = VtoP(center + (up * ((radius + scale * radius) / cos(ANGLE))));
 		newmark = point - point1;
@@ -118,8 +113,7 @@ void sphereflake(FP radius, Point center, int level, Vector up, Vector mark, Boo
 			theta = ((FP)q * 120.0 + 60.0) * DTOR;
 			vector = rotate(up, vector1.neg(), theta);
 			point = VtoP(center + (vector * (radius + radius * scale)));
-			sphere.init(surface, point, radius * scale);
-			f1 << "1\n" << sphere;	// Write out a subsphere
+			writesphere(point, radius * scale);	// Write out a subsphere
 			numberOfObjects++;
 			point1 = VtoP(center + (up.neg() * ((radius + scale * radius) / cos(ANGLE))));
 			newmark = point - point1;
@@ -173,3 +167,10 @@ void writeheader(void)
 	f1 << "1024\n-510.9\n2560\n";				// max
 }
 
+
+void writesphere(Point center, FP ra)
+{
+	// Write a sphere record, giving material 1 in place of its surface.
+
+	f1 << "1\n-1\n" << center << ra << "\n";
+}
@@ -0,0 +1,256 @@
+// accelcache.cc	Keeping a scene's built octree or BVH in a file beside it
+
+#include "platform.h"
+#include "raytrace.h"
+#include "vector.h"
+#include "miscobj.h"
+#include "textures.h"
+#include "object.h"
+#include "planar.h"
+#include "quadric.h"
+#include "octree.h"
+#include "bvh.h"
+#include "pool.h"			// pools
+#include "sdb.h"			// hashobjects
+#include "accelcache.h"
+#include <string.h>
+#include <fcntl.h>			// open
+#include <unistd.h>			// close
+#include <sys/mman.h>		// mmap
+#include <sys/stat.h>		// fstat
+
+// The octree or BVH built for a scene is written to the scene's name with
+// .acc added.  The file is keyed by a hash of every object's fields, the
+// structure and the threshold, so it's only used while the geometry it
+// was built for is unchanged;  otherwise the structure is built again and
+// the file replaced.  Its nodes, and its object list (of handles, which
+// stay the same as long as the objects do), are used where they're mapped.
+
+static char *mapping = NULL;	// The file mapped by loadaccel, if any
+static long mappingsize;
+
+static void cachename(char *scenename, char *name)
+{
+	strcpy(name, scenename);
+	strcat(name, ".acc");
+}
+
+static Boolean checkaccel(Accelheader *header, char *base, long filesize)
+{
+	// Whether a file's nodes and object list are all within it, and lead
+	// only to each other and to objects the scene has.  (A file that's been
+	// damaged, or written by another build, isn't to be followed.)
+
+	OctreeNode *voxel;
+	BVHNode *node;
+	unsigned int *list, handle;
+	long nodesize, x;
+	int offset, count;
+
+	nodesize = (accel == 1) ? sizeof(BVHNode) : sizeof(OctreeNode);
+	if ((header->numberOfNodes <= 0) || (header->numberOfEntries < 0) ||
+	(header->nodeoffset < (long)sizeof(Accelheader)) || (header->listoffset < (long)sizeof(Accelheader)) ||
+	(header->nodeoffset + header->numberOfNodes * nodesize > filesize) ||
+	(header->listoffset + header->numberOfEntries * (long)sizeof(unsigned int) > filesize))
+		return false;
+
+	for (x = 0; x < header->numberOfNodes; x++)
+	{
+		if (accel == 1)
+		{
+			node = &((BVHNode *)&base[header->nodeoffset])[x];
+			offset = node->offset;
+			count = (node->numberOfObjects > 0) ? node->numberOfObjects : -1;
+		}
+		else
+		{
+			voxel = &((OctreeNode *)&base[header->nodeoffset])[x];
+			offset = voxel->offset;
+			count = voxel->numberOfObjects;
+		}
+		if (count >= 0)		// A leaf's objects
+		{
+			if ((offset < 0) || ((long)offset + count > header->numberOfEntries))
+				return false;
+		}
+		else if ((offset <= x) ||		// Children (a BVH's right one, or 8 voxels)
+		((long)offset + ((accel == 1) ? 1 : 8) > header->numberOfNodes))
+			return false;
+	}
+
+	list = (unsigned int *)&base[header->listoffset];
+	for (x = 0; x < header->numberOfEntries; x++)
+	{
+		handle = list[x];
+		if ((handle & HANDLEINDEX) >= (unsigned int)pools[handle >> HANDLESHIFT].count)
+			return false;		// (The pools of codes that aren't objects' are empty.)
+	}
+	return true;
+}
+
+Boolean loadaccel(char *scenename)
+{
+	// Map the octree or BVH (as accel chooses) built for this scene before,
+	// if there's one for its objects as they are.  False if it's to be
+	// built.
+
+	char name[256];
+	Accelheader *header;
+	struct stat status;
+	char *base;
+	int fd;
+
+	cachename(scenename, name);
+	if ((fd = open(name, O_RDONLY)) < 0)
+		return false;
+	if ((fstat(fd, &status) != 0) || (status.st_size < (long)sizeof(Accelheader)))
+	{
+		close(fd);
+		return false;
+	}
+	base = (char *)mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == (char *)MAP_FAILED)
+		return false;
+
+	header = (Accelheader *)base;
+	if ((header->magic != ACCMAGIC) || (header->fpsize != sizeof(FP)) ||
+	(header->accel != accel) || (header->threshold != threshold) ||
+	(header->numberOfObjects != numberOfObjects) || (header->key != hashobjects()) ||
+	(checkaccel(header, base, status.st_size) == false))
+	{
+		munmap(base, status.st_size);
+		return false;
+	}
+
+	if (accel == 1)
+	{
+		bvhnodes = (BVHNode *)&base[header->nodeoffset];
+		numberOfBVHNodes = header->numberOfNodes;
+		bvhlist = (unsigned int *)&base[header->listoffset];
+	}
+	else
+	{
+		octnodes = (OctreeNode *)&base[header->nodeoffset];
+		numberOfVoxels = header->numberOfNodes;
+		octlist = (unsigned int *)&base[header->listoffset];
+
+		rootvoxel.min.init(header->min[0], header->min[1], header->min[2]);
+		rootvoxel.max.init(header->max[0], header->max[1], header->max[2]);
+		rootvoxel.size = header->size;
+		rootvoxel.subdivided = true;
+		rootvoxel.numberOfObjects = 0;
+		rootvoxel.childrenptr = NULL;
+	}
+	mapping = base;
+	mappingsize = status.st_size;
+	return true;
+}
+
+
+void freeaccel(void)
+{
+	// Free the octree or BVH, whether it was built or mapped.
+
+	if (mapping != NULL)
+		munmap(mapping, mappingsize);
+	else
+	{
+		delete [] octnodes;
+		delete [] octlist;
+		delete [] bvhnodes;
+		delete [] bvhlist;
+	}
+	mapping = NULL;
+	octnodes = NULL;
+	octlist = NULL;
+	bvhnodes = NULL;
+	bvhlist = NULL;
+	numberOfVoxels = numberOfBVHNodes = 0;
+}
+
+
+void saveaccel(char *scenename)
+{
+	// Write the octree or BVH just built, for the next run on this scene.
+	// (If it can't be written, it's built again next time.)
+
+	char name[256], temp[256];
+	Accelheader header;
+	unsigned int *list;
+	FILE *f;
+	int x, last;
+	long nodesize;
+
+	memset(&header, 0, sizeof(header));
+	header.magic = ACCMAGIC;
+	header.fpsize = sizeof(FP);
+	header.accel = accel;
+	header.threshold = threshold;
+	header.key = hashobjects();
+	header.numberOfObjects = numberOfObjects;
+
+	// The object list ends after its last leaf's objects.
+
+	header.numberOfEntries = 0;
+	if (accel == 1)
+	{
+		header.numberOfNodes = numberOfBVHNodes;
+		nodesize = sizeof(BVHNode);
+		list = bvhlist;
+		for (x = 0; x < numberOfBVHNodes; x++)
+		{
+			last = bvhnodes[x].offset + bvhnodes[x].numberOfObjects;
+			if ((bvhnodes[x].numberOfObjects > 0) && (last > header.numberOfEntries))
+				header.numberOfEntries = last;
+		}
+	}
+	else
+	{
+		header.numberOfNodes = numberOfVoxels;
+		nodesize = sizeof(OctreeNode);
+		list = octlist;
+		for (x = 0; x < numberOfVoxels; x++)
+		{
+			last = octnodes[x].offset + octnodes[x].numberOfObjects;
+			if ((octnodes[x].numberOfObjects >= 0) && (last > header.numberOfEntries))
+				header.numberOfEntries = last;
+		}
+		header.min[0] = rootvoxel.min.x;
+		header.min[1] = rootvoxel.min.y;
+		header.min[2] = rootvoxel.min.z;
+		header.max[0] = rootvoxel.max.x;
+		header.max[1] = rootvoxel.max.y;
+		header.max[2] = rootvoxel.max.z;
+		header.size = rootvoxel.size;
+	}
+	if (header.numberOfNodes == 0)
+		return;
+
+	header.nodeoffset = (sizeof(Accelheader) + 7) & ~7L;
+	header.listoffset = (header.nodeoffset + header.numberOfNodes * nodesize + 7) & ~7L;
+
+	// Written under another name, and renamed, so that a run that's
+	// interrupted never leaves half a file to be mapped.
+
+	cachename(scenename, name);
+	strcpy(temp, name);
+	strcat(temp, ".tmp");
+	if ((f = fopen(temp, "wb")) == NULL)
+	{
+		printf("The acceleration structure cannot be saved in %s.\n\n", name);
+		return;
+	}
+	fwrite(&header, sizeof(Accelheader), 1, f);
+	fseek(f, header.nodeoffset, SEEK_SET);
+	if (accel == 1)
+		fwrite(bvhnodes, nodesize, header.numberOfNodes, f);
+	else
+		fwrite(octnodes, nodesize, header.numberOfNodes, f);
+	fseek(f, header.listoffset, SEEK_SET);
+	fwrite(list, sizeof(unsigned int), header.numberOfEntries, f);
+	if (fclose(f) == 0)
+		rename(temp, name);
+	else
+		remove(temp);
+}
@@ -0,0 +1,29 @@
+// accelcache.h		Keeping a scene's built octree or BVH in a file beside it
+
+#ifndef accelcache_h
+#define accelcache_h
+
+#define ACCMAGIC 0x33434341		// "ACC3"
+
+class Accelheader		// The header of an acceleration structure file
+{
+	public:
+
+	int magic;
+	int fpsize;				// sizeof(FP) in the program that built it
+	int accel;				// 0 = octree, 1 = BVH
+	int threshold;			// The octree's objects per voxel
+	unsigned long long key;	// hashobjects() of the scene it was built for
+	int numberOfObjects;
+	int numberOfNodes;		// Voxels or BVH nodes
+	long numberOfEntries;	// Entries in the packed object list
+	FP min[3], max[3], size;	// Octree:  the root voxel's extents
+	long nodeoffset;		// Where the nodes are in the file
+	long listoffset;		// Where the object list is, as handles
+};
+
+Boolean loadaccel(char *scenename);
+void saveaccel(char *scenename);
+void freeaccel(void);
+
+#endif	// Of accelcache_h
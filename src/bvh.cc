@@ -0,0 +1,708 @@
+// bvh.cc		Bounding volume hierarchy, built with the surface area heuristic
+
+#include <thread>			// (These must precede raytrace.h's min & max.)
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>		// For packetboxes()
+#endif
+#include "raytrace.h"
+#include "vector.h"
+#include "miscobj.h"
+#include "textures.h"
+#include "object.h"
+#include "planar.h"
+#include "quadric.h"
+#include "octree.h"			// For the build thread functions
+#include "bvh.h"
+#include "pool.h"			// icheckhandle, handleobject
+#include "spheres.h"		// nearestsphere
+
+static unsigned int bvhwalk(Ray& ray, Interdata& idn, FP maxt, Boolean anyhit, int start);
+static inline Boolean bvhleaf(Ray& ray, BVHNode *node, int index, FP& closest,
+unsigned int& closeptr, Interdata& idn, Boolean anyhit);
+static BVHBuild *bvhbuild(BVHItem *items, int first, int count, int depth);
+static void bvhthread(BVHItem *items, int first, int count, int depth, BVHBuild **node);
+static void bvhflatten(BVHBuild *build);
+static int bvhnext;		// The next free entry in bvhnodes while flattening
+
+
+static inline FP axisof(Point& p, int axis)
+{
+	if (axis == 0)
+		return p.x;
+	else if (axis == 1)
+		return p.y;
+	else
+		return p.z;
+}
+
+static inline FP area(Point& min, Point& max)	// Surface area of a box
+{
+	FP dx = max.x - min.x;
+	FP dy = max.y - min.y;
+	FP dz = max.z - min.z;
+
+	return 2.0 * (dx * dy + dy * dz + dz * dx);
+}
+
+static inline void grow(Point& min, Point& max, Point& pmin, Point& pmax)
+{
+	// Enlarge the box min, max to take in the box pmin, pmax.
+
+	if (pmin.x < min.x)
+		min.x = pmin.x;
+	if (pmin.y < min.y)
+		min.y = pmin.y;
+	if (pmin.z < min.z)
+		min.z = pmin.z;
+	if (pmax.x > max.x)
+		max.x = pmax.x;
+	if (pmax.y > max.y)
+		max.y = pmax.y;
+	if (pmax.z > max.z)
+		max.z = pmax.z;
+}
+
+static inline float rounddown(FP x)	// The nearest float <= x
+{
+	float f = (float)x;
+
+	if (f > x)
+		f = nextafterf(f, -HUGE_VALF);
+	return f;
+}
+
+static inline float roundup(FP x)	// The nearest float >= x
+{
+	float f = (float)x;
+
+	if (f < x)
+		f = nextafterf(f, HUGE_VALF);
+	return f;
+}
+
+static inline Boolean boxcheck(BVHNode& node, FP o[3], FP inv[3], FP closest, FP& tn)
+{
+	// Slab test of a ray against a node's box.  Succeeds if the ray enters the
+	// box before closest; tn is then the distance at which it enters.
+
+	FP t1, t2, tf;
+
+	t1 = (node.min[0] - o[0]) * inv[0];
+	t2 = (node.max[0] - o[0]) * inv[0];
+	tn = min(t1, t2);
+	tf = max(t1, t2);
+
+	t1 = (node.min[1] - o[1]) * inv[1];
+	t2 = (node.max[1] - o[1]) * inv[1];
+	tn = max(tn, min(t1, t2));
+	tf = min(tf, max(t1, t2));
+
+	t1 = (node.min[2] - o[2]) * inv[2];
+	t2 = (node.max[2] - o[2]) * inv[2];
+	tn = max(tn, min(t1, t2));
+	tf = min(tf, max(t1, t2));
+
+	if ((tn <= tf) && (tf >= 0.0) && (tn < closest))
+		return true;
+	else
+		return false;
+}
+
+
+Object *checkbvh(Ray& ray, Interdata& idn)	// The closest object hit by ray
+{
+	unsigned int handle = bvhwalk(ray, idn, 9999999999.0, false, 0);
+
+	return (handle != 0) ? handleobject(handle) : (Object *)NULL;
+}
+
+
+unsigned int bvhoccluded(Ray& ray, FP maxt)	// Any object that blocks ray before maxt
+{
+	Interdata id;
+
+	return bvhwalk(ray, id, maxt, true, 0);
+}
+
+
+static unsigned int bvhwalk(Ray& ray, Interdata& idn, FP maxt, Boolean anyhit, int start)
+{
+	// Find the closest object hit by ray before maxt, below the node start.
+	// Nodes are visited nearest child first, and any node the ray enters
+	// beyond the closest hit so far is skipped.  If anyhit is true, the
+	// first object hit before maxt is returned instead.  (Its handle is, or
+	// 0 for none.)
+
+	BVHEntry stack[BVHMAXDEPTH + 2];
+	Interdata id;
+	BVHNode *node;
+	FP o[3], inv[3], tl, tr, closest = maxt;
+	unsigned int closeptr = 0;
+	int sp, l, r;
+	Boolean hitl, hitr;
+
+	if (numberOfBVHNodes == 0)
+		return 0;
+
+	o[0] = ray.origin.x;
+	o[1] = ray.origin.y;
+	o[2] = ray.origin.z;
+
+	// A huge finite inverse keeps 0 * inverse out of the slab test:
+
+	inv[0] = (ray.direction.dx != 0.0) ? 1.0 / ray.direction.dx : 1.0e300;
+	inv[1] = (ray.direction.dy != 0.0) ? 1.0 / ray.direction.dy : 1.0e300;
+	inv[2] = (ray.direction.dz != 0.0) ? 1.0 / ray.direction.dz : 1.0e300;
+
+	if (boxcheck(bvhnodes[start], o, inv, closest, tl) == false)
+		return 0;	// No intersection with the world.
+
+	stack[0].node = start;
+	stack[0].tn = tl;
+	sp = 1;
+
+	while (sp > 0)
+	{
+		sp--;
+		if (stack[sp].tn >= closest)
+			continue;	// Something nearer has been found since this was pushed.
+
+		node = &bvhnodes[stack[sp].node];
+		if (node->numberOfObjects > 0)
+		{
+			if ((bvhleaf(ray, node, stack[sp].node, closest, closeptr, idn, anyhit) == true) &&
+			(anyhit == true))
+				return closeptr;
+			continue;
+		}
+
+		// The left child follows its parent; the right one is at offset.
+
+		l = stack[sp].node + 1;
+		r = node->offset;
+		hitl = boxcheck(bvhnodes[l], o, inv, closest, tl);
+		hitr = boxcheck(bvhnodes[r], o, inv, closest, tr);
+
+		if ((hitl == true) && (hitr == true))
+		{
+			if (tl <= tr)	// Push the farther child first.
+			{
+				stack[sp].node = r;
+				stack[sp].tn = tr;
+				stack[sp + 1].node = l;
+				stack[sp + 1].tn = tl;
+			}
+			else
+			{
+				stack[sp].node = l;
+				stack[sp].tn = tl;
+				stack[sp + 1].node = r;
+				stack[sp + 1].tn = tr;
+			}
+			sp += 2;
+		}
+		else if (hitl == true)
+		{
+			stack[sp].node = l;
+			stack[sp].tn = tl;
+			sp++;
+		}
+		else if (hitr == true)
+		{
+			stack[sp].node = r;
+			stack[sp].tn = tr;
+			sp++;
+		}
+	}
+	return closeptr;
+}
+
+
+static inline Boolean bvhleaf(Ray& ray, BVHNode *node, int index, FP& closest,
+unsigned int& closeptr, Interdata& idn, Boolean anyhit)
+{
+	// Test ray against the objects in the leaf node (bvhnodes[index]), and
+	// keep the closest one hit before closest.  True if one was;  if anyhit
+	// is true, the first one hit is kept.
+
+	SphereRun *run = &sphereruns[index];
+	Interdata id;
+	Boolean found = false;
+	FP t;
+	int n, s;
+
+	// The spheres the list starts with are tested a block at a time, for
+	// the nearest one hit.
+
+	t = 0.0;
+	while ((run->count > 0) &&
+	((s = nearestsphere(&sphereblocks[run->block], run->count, ray, t, t)) >= 0) &&
+	(t < closest))
+	{
+		if ((((Sphere *)handleobject(bvhlist[node->offset + s]))->Sphere::icheck(ray, id) == true) &&
+		(id.t < closest))
+		{
+			closeptr = bvhlist[node->offset + s];
+			closest = id.t;
+			idn = id;
+			if (anyhit == true)
+				return true;
+			found = true;
+			break;
+		}
+	}
+
+	for (n = node->offset + run->count; n < node->offset + node->numberOfObjects; n++)
+	{
+		if ((icheckhandle(bvhlist[n], ray, id) == true) && (id.t < closest))
+		{
+			closeptr = bvhlist[n];
+			closest = id.t;
+			idn = id;
+			if (anyhit == true)
+				return true;
+			found = true;
+		}
+	}
+	return found;
+}
+
+
+static inline int packetboxes(BVHNode& node, FP o[3][PACKETSIZE], FP inv[3][PACKETSIZE],
+FP closest[PACKETSIZE], FP tn[PACKETSIZE])
+{
+	// boxcheck() for each ray of a packet, done together where the processor
+	// allows.  Returns the rays that enter the node's box before their
+	// closest (bit k for ray k), with tn set for each of them.
+
+	int k, mask = 0;
+
+#if defined(__AVX__)
+	__m256d t1, t2, near, far;
+	int a;
+
+	for (k = 0; k < PACKETSIZE; k += 4)
+	{
+		near = _mm256_set1_pd(-HUGE_VAL);
+		far = _mm256_set1_pd(HUGE_VAL);
+		for (a = 0; a < 3; a++)
+		{
+			t1 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(node.min[a]), _mm256_load_pd(&o[a][k])),
+			_mm256_load_pd(&inv[a][k]));
+			t2 = _mm256_mul_pd(_mm256_sub_pd(_mm256_set1_pd(node.max[a]), _mm256_load_pd(&o[a][k])),
+			_mm256_load_pd(&inv[a][k]));
+			near = (a == 0) ? _mm256_min_pd(t1, t2) : _mm256_max_pd(near, _mm256_min_pd(t1, t2));
+			far = (a == 0) ? _mm256_max_pd(t1, t2) : _mm256_min_pd(far, _mm256_max_pd(t1, t2));
+		}
+		_mm256_storeu_pd(&tn[k], near);
+		mask |= _mm256_movemask_pd(_mm256_and_pd(_mm256_and_pd(_mm256_cmp_pd(near, far, _CMP_LE_OQ),
+		_mm256_cmp_pd(far, _mm256_setzero_pd(), _CMP_GE_OQ)),
+		_mm256_cmp_pd(near, _mm256_load_pd(&closest[k]), _CMP_LT_OQ))) << k;
+	}
+#elif defined(__SSE2__)
+	__m128d t1, t2, near, far;
+	int a;
+
+	for (k = 0; k < PACKETSIZE; k += 2)
+	{
+		near = _mm_set1_pd(-HUGE_VAL);
+		far = _mm_set1_pd(HUGE_VAL);
+		for (a = 0; a < 3; a++)
+		{
+			t1 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(node.min[a]), _mm_load_pd(&o[a][k])),
+			_mm_load_pd(&inv[a][k]));
+			t2 = _mm_mul_pd(_mm_sub_pd(_mm_set1_pd(node.max[a]), _mm_load_pd(&o[a][k])),
+			_mm_load_pd(&inv[a][k]));
+			near = (a == 0) ? _mm_min_pd(t1, t2) : _mm_max_pd(near, _mm_min_pd(t1, t2));
+			far = (a == 0) ? _mm_max_pd(t1, t2) : _mm_min_pd(far, _mm_max_pd(t1, t2));
+		}
+		_mm_storeu_pd(&tn[k], near);
+		mask |= _mm_movemask_pd(_mm_and_pd(_mm_and_pd(_mm_cmple_pd(near, far),
+		_mm_cmpge_pd(far, _mm_setzero_pd())), _mm_cmplt_pd(near, _mm_load_pd(&closest[k])))) << k;
+	}
+#else
+	FP ok[3], ik[3];
+
+	for (k = 0; k < PACKETSIZE; k++)
+	{
+		ok[0] = o[0][k];
+		ok[1] = o[1][k];
+		ok[2] = o[2][k];
+		ik[0] = inv[0][k];
+		ik[1] = inv[1][k];
+		ik[2] = inv[2][k];
+		if (boxcheck(node, ok, ik, closest[k], tn[k]) == true)
+			mask |= 1 << k;
+	}
+#endif
+	return mask;
+}
+
+
+void bvhpacket(Ray *rays, Interdata *idn, unsigned int *hits, int count)
+{
+	// Walk the BVH with count (up to PACKETSIZE) rays at once, finding the
+	// closest object each hits, as bvhwalk does.  Each box is tested against
+	// every ray of the packet together (packetboxes), and the children are
+	// visited in the order the first ray still in the packet meets them.
+	// Once only one ray is left in a node, it walks the rest alone.
+
+	BVHPacketEntry stack[BVHMAXDEPTH + 2];
+	Interdata id;
+	BVHNode *node;
+	alignas(32) FP o[3][PACKETSIZE], inv[3][PACKETSIZE], closest[PACKETSIZE];
+	alignas(32) FP tl[PACKETSIZE], tr[PACKETSIZE];
+	FP t;
+	unsigned int handle;
+	int sp, k, a, l, r, mask, ml, mr, first;
+
+	for (k = 0; k < PACKETSIZE; k++)
+	{
+		if (k < count)
+		{
+			hits[k] = 0;
+			closest[k] = 9999999999.0;
+			o[0][k] = rays[k].origin.x;
+			o[1][k] = rays[k].origin.y;
+			o[2][k] = rays[k].origin.z;
+			inv[0][k] = (rays[k].direction.dx != 0.0) ? 1.0 / rays[k].direction.dx : 1.0e300;
+			inv[1][k] = (rays[k].direction.dy != 0.0) ? 1.0 / rays[k].direction.dy : 1.0e300;
+			inv[2][k] = (rays[k].direction.dz != 0.0) ? 1.0 / rays[k].direction.dz : 1.0e300;
+		}
+		else	// An unused lane, which never enters a box
+		{
+			closest[k] = -HUGE_VAL;
+			o[0][k] = o[1][k] = o[2][k] = 0.0;
+			inv[0][k] = inv[1][k] = inv[2][k] = 1.0;
+		}
+	}
+	if (numberOfBVHNodes == 0)
+		return;
+
+	stack[0].node = 0;
+	stack[0].mask = packetboxes(bvhnodes[0], o, inv, closest, stack[0].tn);
+	sp = 1;
+
+	while (sp > 0)
+	{
+		sp--;
+		mask = 0;
+		for (k = 0; k < count; k++)
+			if (((stack[sp].mask & (1 << k)) != 0) && (stack[sp].tn[k] < closest[k]))
+				mask |= 1 << k;
+		if (mask == 0)
+			continue;	// Every ray has hit something nearer.
+		for (first = 0; (mask & (1 << first)) == 0; first++)
+			;
+
+		if ((mask & (mask - 1)) == 0)	// Only one ray is left:  it goes on alone.
+		{
+			handle = bvhwalk(rays[first], id, closest[first], false, stack[sp].node);
+			if (handle != 0)
+			{
+				hits[first] = handle;
+				closest[first] = id.t;
+				idn[first] = id;
+			}
+			continue;
+		}
+
+		node = &bvhnodes[stack[sp].node];
+		if (node->numberOfObjects > 0)
+		{
+			for (k = first; k < count; k++)
+				if ((mask & (1 << k)) != 0)
+					bvhleaf(rays[k], node, stack[sp].node, closest[k], hits[k], idn[k], false);
+			continue;
+		}
+
+		l = stack[sp].node + 1;
+		r = node->offset;
+		ml = packetboxes(bvhnodes[l], o, inv, closest, tl) & mask;
+		mr = packetboxes(bvhnodes[r], o, inv, closest, tr) & mask;
+
+		// Push the child the first ray meets later (or not at all) first.
+
+		if ((mr != 0) && ((ml == 0) || (((ml & (1 << first)) == 0) && ((mr & (1 << first)) != 0)) ||
+		(((ml & mr & (1 << first)) != 0) && (tr[first] < tl[first]))))
+		{
+			a = l;
+			l = r;
+			r = a;
+			a = ml;
+			ml = mr;
+			mr = a;
+			for (k = first; k < count; k++)
+			{
+				t = tl[k];
+				tl[k] = tr[k];
+				tr[k] = t;
+			}
+		}
+		if (mr != 0)
+		{
+			stack[sp].node = r;
+			stack[sp].mask = mr;
+			for (k = first; k < count; k++)
+				stack[sp].tn[k] = tr[k];
+			sp++;
+		}
+		if (ml != 0)
+		{
+			stack[sp].node = l;
+			stack[sp].mask = ml;
+			for (k = first; k < count; k++)
+				stack[sp].tn[k] = tl[k];
+			sp++;
+		}
+	}
+}
+
+
+void buildBVH(void)
+{
+	BVHItem *items;
+	BVHBuild *root;
+	int x, n;
+
+	// Cylinders, quadrics and rings have no usable extents (they never pass
+	// voxelicheck), so, as with the octree, they're left out.
+
+	items = new BVHItem[numberOfObjects];
+	n = 0;
+	for (x = 0; x < numberOfObjects; x++)
+	{
+		if ((objtype[x] == 4) || (objtype[x] == 5) || (objtype[x] == 9))
+			continue;
+		items[n].min = objptr[x]->getMin();
+		items[n].max = objptr[x]->getMax();
+		items[n].centroid.init((items[n].min.x + items[n].max.x) / 2,
+		(items[n].min.y + items[n].max.y) / 2, (items[n].min.z + items[n].max.z) / 2);
+		items[n].object = x;
+		n++;
+	}
+
+	numberOfBVHNodes = 0;
+	if (n == 0)
+	{
+		delete [] items;
+		return;
+	}
+
+	startbuildthreads();
+	root = bvhbuild(items, 0, n, 0);
+	numberOfBVHNodes = root->numberOfNodes;
+
+	// Next, flatten the tree into bvhnodes, each left child immediately
+	// after its parent.  The build left every leaf's objects next to each
+	// other in items, so those become the packed object list.
+
+	bvhnodes = new BVHNode[numberOfBVHNodes];
+	bvhlist = new unsigned int[n];
+	for (x = 0; x < n; x++)
+		bvhlist[x] = objhandle[items[x].object];
+
+	bvhnext = 0;
+	bvhflatten(root);
+	delete [] items;
+}
+
+
+static BVHBuild *bvhbuild(BVHItem *items, int first, int count, int depth)
+{
+	// Build the subtree over items[first] to items[first + count - 1].  The
+	// items are partitioned in place, so every node owns a contiguous range,
+	// and the two halves can be built on different threads.
+
+	BVHBuild *node;
+	Point cmin, cmax, bmin[BVHBINS], bmax[BVHBINS], lmin, lmax, rmin, rmax;
+	FP extent, c, cost, bestcost, larea[BVHBINS], nodearea;
+	int bcount[BVHBINS], lcount[BVHBINS], x, b, a, nl, nr, bestaxis, bestbin;
+	BVHItem temp;
+	thread *right = NULL;
+
+	if (!(node = new BVHBuild))
+	{
+		printf("\nInsufficient memory to allocate a BVH node.\n");
+		exit(1);
+	}
+
+	node->first = first;
+	node->count = count;
+	node->numberOfNodes = 1;
+	node->left = NULL;
+	node->right = NULL;
+	node->min = items[first].min;
+	node->max = items[first].max;
+	cmin = items[first].centroid;
+	cmax = items[first].centroid;
+	for (x = first + 1; x < first + count; x++)
+	{
+		grow(node->min, node->max, items[x].min, items[x].max);
+		grow(cmin, cmax, items[x].centroid, items[x].centroid);
+	}
+
+	if ((count == 1) || (depth >= BVHMAXDEPTH))
+		return node;
+
+	// Drop the objects' centroids into buckets along each axis, and find the
+	// bucket boundary where splitting is cheapest.  A split costs one box
+	// test, plus each side's objects weighted by the chance (surface area) of
+	// a ray that hits this node also hitting that side.
+
+	nodearea = area(node->min, node->max);
+	bestcost = HUGE_VAL;
+	bestaxis = -1;
+	bestbin = 0;
+	for (a = 0; a < 3; a++)
+	{
+		extent = axisof(cmax, a) - axisof(cmin, a);
+		if (extent <= 0.0)
+			continue;	// Every centroid is in the same place on this axis.
+
+		for (b = 0; b < BVHBINS; b++)
+			bcount[b] = 0;
+		for (x = first; x < first + count; x++)
+		{
+			c = axisof(items[x].centroid, a);
+			b = (int)(BVHBINS * (c - axisof(cmin, a)) / extent);
+			if (b >= BVHBINS)
+				b = BVHBINS - 1;
+			if (bcount[b] == 0)
+			{
+				bmin[b] = items[x].min;
+				bmax[b] = items[x].max;
+			}
+			else
+				grow(bmin[b], bmax[b], items[x].min, items[x].max);
+			bcount[b]++;
+		}
+
+		// Sweep from the left, then from the right:
+
+		nl = 0;
+		for (b = 0; b < BVHBINS - 1; b++)
+		{
+			if (bcount[b] > 0)
+			{
+				if (nl == 0)
+				{
+					lmin = bmin[b];
+					lmax = bmax[b];
+				}
+				else
+					grow(lmin, lmax, bmin[b], bmax[b]);
+				nl += bcount[b];
+			}
+			lcount[b] = nl;
+			larea[b] = (nl > 0) ? area(lmin, lmax) : 0.0;
+		}
+
+		nr = 0;
+		for (b = BVHBINS - 1; b > 0; b--)
+		{
+			if (bcount[b] > 0)
+			{
+				if (nr == 0)
+				{
+					rmin = bmin[b];
+					rmax = bmax[b];
+				}
+				else
+					grow(rmin, rmax, bmin[b], bmax[b]);
+				nr += bcount[b];
+			}
+			if ((lcount[b - 1] == 0) || (nr == 0))
+				continue;	// Not a real split.
+
+			cost = BVHTRAVERSE * nodearea + BVHINTERSECT *
+			(larea[b - 1] * lcount[b - 1] + area(rmin, rmax) * nr);
+			if (cost < bestcost)
+			{
+				bestcost = cost;
+				bestaxis = a;
+				bestbin = b;
+			}
+		}
+	}
+
+	if (bestaxis == -1)
+		return node;	// All the centroids coincide - it can't be split.
+
+	// Only split if it's cheaper than testing every object here, unless
+	// there are more objects than the threshold allows in one leaf.
+
+	if ((bestcost >= BVHINTERSECT * count * nodearea) && (count <= threshold))
+		return node;
+
+	// Partition the items about the chosen bucket boundary:
+
+	extent = axisof(cmax, bestaxis) - axisof(cmin, bestaxis);
+	nl = first;
+	for (x = first; x < first + count; x++)
+	{
+		c = axisof(items[x].centroid, bestaxis);
+		b = (int)(BVHBINS * (c - axisof(cmin, bestaxis)) / extent);
+		if (b >= BVHBINS)
+			b = BVHBINS - 1;
+		if (b < bestbin)
+		{
+			temp = items[x];
+			items[x] = items[nl];
+			items[nl] = temp;
+			nl++;
+		}
+	}
+	nl -= first;
+
+	if ((count - nl >= BUILDGRAIN) && (claimbuildthread() == true))
+		right = new thread(bvhthread, items, first + nl, count - nl, depth + 1, &node->right);
+	else
+		node->right = bvhbuild(items, first + nl, count - nl, depth + 1);
+	node->left = bvhbuild(items, first, nl, depth + 1);
+	if (right != NULL)
+	{
+		right->join();
+		delete right;
+	}
+	node->numberOfNodes += node->left->numberOfNodes + node->right->numberOfNodes;
+	return node;
+}
+
+
+static void bvhthread(BVHItem *items, int first, int count, int depth, BVHBuild **node)
+{
+	*node = bvhbuild(items, first, count, depth);
+	releasebuildthread();
+}
+
+
+static void bvhflatten(BVHBuild *build)
+{
+	int index = bvhnext++;
+
+	// Single precision halves the node size; rounding the bounds outward
+	// keeps them conservative, so no hit is ever lost to it.
+
+	bvhnodes[index].min[0] = rounddown(build->min.x);
+	bvhnodes[index].min[1] = rounddown(build->min.y);
+	bvhnodes[index].min[2] = rounddown(build->min.z);
+	bvhnodes[index].max[0] = roundup(build->max.x);
+	bvhnodes[index].max[1] = roundup(build->max.y);
+	bvhnodes[index].max[2] = roundup(build->max.z);
+
+	if (build->left == NULL)	// A leaf
+	{
+		bvhnodes[index].offset = build->first;
+		bvhnodes[index].numberOfObjects = build->count;
+		sorthandles(&bvhlist[build->first], build->count);
+	}
+	else
+	{
+		bvhnodes[index].numberOfObjects = 0;
+		bvhflatten(build->left);
+		bvhnodes[index].offset = bvhnext;
+		bvhflatten(build->right);
+	}
+	delete build;
+}
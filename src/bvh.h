@@ -0,0 +1,71 @@
+// bvh.h		Bounding volume hierarchy declarations
+
+#ifndef bvh_h
+#define bvh_h
+
+#include "platform.h"
+
+#define BVHBINS 16			// The number of SAH buckets tried along each axis
+#define BVHMAXDEPTH 64		// Deeper nodes are always made into leaves
+#define BVHTRAVERSE 1.0		// SAH cost of a box test
+#define BVHINTERSECT 2.0	// SAH cost of an object test
+
+extern Object **objptr;
+extern int *objtype;
+extern unsigned int *objhandle;
+extern int numberOfObjects, threshold, numberOfBVHNodes;
+
+class BVHItem		// An object, and its extents, while the BVH is built
+{
+	public:
+
+	Point min, max;		// The object's extents
+	Point centroid;		// The center of its extents
+	int object;			// Its index in objptr
+};
+
+class BVHBuild		// A node of the BVH while it is being built
+{
+	public:
+
+	Point min, max;		// Extents of everything below this node
+	int first, count;	// The node's range in the item array
+	int numberOfNodes;	// The number of nodes in this subtree
+	BVHBuild *left, *right;	// The children (NULL for a leaf)
+};
+
+class BVHNode		// A node of the finished BVH (32 bytes)
+{
+	public:
+
+	float min[3], max[3];	// Extents of everything below this node, rounded outward
+	int offset;			// Leaf: first object in bvhlist.  Interior: right child.
+	int numberOfObjects;	// The number of objects in a leaf (0 if interior)
+};
+
+class BVHEntry		// A node waiting on the traversal stack
+{
+	public:
+
+	int node;			// Its index in bvhnodes
+	FP tn;				// Where the ray enters its box
+};
+
+class BVHPacketEntry	// A node waiting on the packet traversal stack
+{
+	public:
+
+	int node;				// Its index in bvhnodes
+	int mask;				// The rays that enter its box (bit k for rays[k])
+	FP tn[PACKETSIZE];		// Where each of them enters it
+};
+
+extern BVHNode *bvhnodes;
+extern unsigned int *bvhlist;	// Handles (see pool.h)
+
+Object *checkbvh(Ray& ray, Interdata& idn);
+unsigned int bvhoccluded(Ray& ray, FP maxt);
+void bvhpacket(Ray *rays, Interdata *idn, unsigned int *hits, int count);
+void buildBVH(void);
+
+#endif	// Of bvh_h
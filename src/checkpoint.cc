@@ -0,0 +1,169 @@
+// checkpoint.cc	Saving a render's progress, so it can be resumed
+
+#include <thread>				// (These must precede raytrace.h's min & max.)
+#include <mutex>
+#include <condition_variable>
+#include "raytrace.h"
+#include "checkpoint.h"
+#include <string.h>				// (ANSI)
+
+// checkpoint() copies the header and data into a buffer, and a thread of
+// its own writes the buffer out, so the renderer only waits for the copy.
+// The file is written under a temporary name and then renamed, so a
+// render killed while checkpointing leaves the last checkpoint intact.
+// If a checkpoint is taken while the last one is still being written,
+// only the newest is kept.
+
+static thread *writer = NULL;
+static mutex ckplock;
+static condition_variable ckpready;
+static char ckpname[140], ckptemp[144];
+static char *pending = NULL, *writing = NULL;	// Header and data, back to back
+static long pendingsize = 0, writingsize = 0, pendingmax = 0, writingmax = 0;
+static Boolean waiting = false;			// True if pending holds a checkpoint
+static Boolean quitting = false;
+
+static void writecheckpoints(void)
+{
+	FILE *f;
+	char *swap;
+	long swapmax;
+	unique_lock<mutex> lock(ckplock);
+
+	for (;;)
+	{
+		while ((waiting == false) && (quitting == false))
+			ckpready.wait(lock);
+		if (waiting == false)	// Quitting, and everything's written
+			return;
+
+		swap = writing;			// Take the pending checkpoint
+		writing = pending;
+		pending = swap;
+		swapmax = writingmax;
+		writingmax = pendingmax;
+		pendingmax = swapmax;
+		writingsize = pendingsize;
+		waiting = false;
+		lock.unlock();
+
+		if (((f = fopen(ckptemp, "wb")) == NULL) ||
+		(fwrite(writing, 1, writingsize, f) != (size_t)writingsize) || (fclose(f) != 0) ||
+		(rename(ckptemp, ckpname) != 0))
+			printf("\nThe checkpoint file %s cannot be written.\n", ckpname);
+
+		lock.lock();
+	}
+}
+
+
+unsigned int hashfile(char *filename)
+{
+	// The 32-bit FNV-1a hash of a file's contents (0 if it can't be read).
+
+	FILE *f;
+	unsigned int hash = 2166136261U;
+	unsigned char buffer[65536];
+	size_t n, x;
+
+	if ((f = fopen(filename, "rb")) == NULL)
+		return 0;
+	while ((n = fread(buffer, 1, sizeof(buffer), f)) > 0)
+		for (x = 0; x < n; x++)
+			hash = (hash ^ buffer[x]) * 16777619U;
+	fclose(f);
+	return hash;
+}
+
+void startcheckpoints(char *filename)
+{
+	strcpy(ckpname, filename);
+	strcpy(ckptemp, filename);
+	strcat(ckptemp, ".tmp");
+	quitting = false;
+	writer = new thread(writecheckpoints);
+}
+
+void checkpoint(Checkpoint& header, char **data)
+{
+	// Queue a checkpoint:  the header, followed by its data blocks.
+
+	long total, offset;
+	int x;
+	lock_guard<mutex> lock(ckplock);
+
+	total = sizeof(Checkpoint);
+	for (x = 0; x < header.numberOfData; x++)
+		total += header.size[x];
+	if (total > pendingmax)
+	{
+		delete [] pending;
+		if (!(pending = new char[total]))
+		{
+			printf("\nInsufficient memory to allocate space for a checkpoint.\n");
+			exit(1);
+		}
+		pendingmax = total;
+	}
+
+	memcpy(pending, &header, sizeof(Checkpoint));
+	offset = sizeof(Checkpoint);
+	for (x = 0; x < header.numberOfData; x++)
+	{
+		memcpy(&pending[offset], data[x], header.size[x]);
+		offset += header.size[x];
+	}
+	pendingsize = total;
+	waiting = true;
+	ckpready.notify_one();
+}
+
+void stopcheckpoints(void)
+{
+	// Finish writing any checkpoint that's queued, and stop the writer.
+
+	{
+		lock_guard<mutex> lock(ckplock);
+		quitting = true;
+		ckpready.notify_one();
+	}
+	writer->join();
+	delete writer;
+	writer = NULL;
+	delete [] pending;
+	delete [] writing;
+	pending = writing = NULL;
+	pendingmax = writingmax = 0;
+}
+
+Boolean readcheckpoint(char *filename, Checkpoint& header, char **data)
+{
+	// Read the checkpoint in filename into data, whose blocks must be the
+	// sizes given in header.  Returns false if there's no such checkpoint,
+	// it was taken of a different render, or it's cut short - in which
+	// case some of data may have been overwritten.
+
+	FILE *f;
+	Checkpoint h;
+	int x;
+	Boolean ok;
+
+	if ((f = fopen(filename, "rb")) == NULL)
+		return false;
+
+	ok = (fread(&h, sizeof(Checkpoint), 1, f) == 1) && (h.magic == CKPMAGIC) &&
+	(h.scene == header.scene) && (h.hres == header.hres) && (h.vres == header.vres) &&
+	(h.bytes_per_pixel == header.bytes_per_pixel) && (h.supersample == header.supersample) &&
+	(h.startingline == header.startingline) && (h.numlines == header.numlines) &&
+	(h.progressive == header.progressive) && (h.numberOfTiles == header.numberOfTiles) &&
+	(h.numberOfData == header.numberOfData);
+	for (x = 0; (ok == true) && (x < h.numberOfData); x++)
+		ok = (h.size[x] == header.size[x]);
+	for (x = 0; (ok == true) && (x < h.numberOfData); x++)
+		ok = (fread(data[x], 1, h.size[x], f) == (size_t)h.size[x]);
+	fclose(f);
+
+	if (ok == true)
+		header = h;
+	return ok;
+}
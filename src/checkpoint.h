@@ -0,0 +1,30 @@
+// checkpoint.h		Saving a render's progress, so it can be resumed
+
+#ifndef checkpoint_h
+#define checkpoint_h
+
+#define CKPMAGIC 0x31504b43		// "CKP1"
+#define CKPMAXDATA 4			// The most blocks of data in a checkpoint
+
+class Checkpoint		// The header of a checkpoint file
+{
+	public:
+
+	int magic;
+	unsigned int scene;		// A hash of the scene description file
+	int hres, vres, bytes_per_pixel;
+	int supersample, startingline, numlines;
+	int progressive;		// True if rendered in progressive passes
+	int passes;				// Progressive:  the passes finished
+	int numberOfTiles;		// Otherwise:  the number of tiles
+	int numberOfData;		// The blocks of data that follow
+	long size[CKPMAXDATA];	// Their sizes, in bytes
+};
+
+unsigned int hashfile(char *filename);
+void startcheckpoints(char *filename);
+void checkpoint(Checkpoint& header, char **data);
+void stopcheckpoints(void);
+Boolean readcheckpoint(char *filename, Checkpoint& header, char **data);
+
+#endif	// Of checkpoint_h
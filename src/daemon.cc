@@ -0,0 +1,599 @@
+// daemon.cc	Serving render requests from scenes kept loaded between them
+
+#include <atomic>				// (Must precede raytrace.h's min & max.)
+#include "platform.h"
+#include "raytrace.h"
+#include "vector.h"
+#include "miscobj.h"
+#include "scene.h"				// setcamera
+#include "tiles.h"
+#include "checkpoint.h"			// hashfile
+#include "daemon.h"
+#include <string.h>
+#include <unistd.h>				// fork, read, write
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>				// sockaddr_un
+#include <sys/stat.h>			// stat
+#include <sys/mman.h>			// mmap
+
+// The daemon listens on a Unix socket.  A client connects and sends one
+// line, either "stop" or
+//
+//		render sdfname [camera x y z dx dy dz] [region x0 y0 x1 y1]
+//			[supersample n] [frame n]
+//
+// where sdfname is given without its .sdf, as on the command line (or is a
+// compiled scene's .sdb), and the region is in pixels, from (x0, y0) up
+// to, but not including, (x1, y1).
+// The reply is "ok width height bytes_per_pixel", a newline and then the
+// region's rows of pixels, sent a band of tiles at a time as they're
+// finished;  or "error" and the reason, on one line.
+//
+// Each scene is loaded by a scene process, which the daemon forks.  It
+// loads the scene, builds its octree or BVH and then waits for requests,
+// which the daemon passes to it with the client's socket.  For each it
+// forks a render process, so requests on one scene are rendered at once,
+// sharing the scene's memory.  Scenes are known by the hash of their scene
+// description files, so a file that's changed is loaded again.  (A file
+// is only hashed again if its size or time of modification has changed.)
+// The render processes running at once share the threads between them.
+//
+// The daemon reads the requests of up to DAEMONCLIENTS clients at once,
+// as their characters arrive, so a slow client holds up no one else.
+
+extern int hres, vres, bytes_per_pixel, supersample, startingline, numlines;
+extern int framenumber, numberOfThreads;
+extern unsigned char *image;
+extern Color *pilot;
+
+void preparescene(char *sdfname, int accelopt);
+void renderpixels(int x, int y, int count, Color *colors);
+void storepixel(unsigned char *pixel, Color& pcolor);
+void renderpilots(int x0, int y0, int x1, int y1);
+void flushstats(void);
+
+static Daemonscene scenes[DAEMONSCENES];
+static Daemonclient clients[DAEMONCLIENTS];
+static int numberOfClients = 0;
+static int listener;			// The daemon's socket
+static int regionx0, regionx1;	// A render process's columns
+static atomic<int> *rendering;	// The render processes running (shared by all)
+static int loadingfd = -1;		// A scene process's socket while it loads its scene
+
+static Boolean writefull(int fd, void *buffer, long size)
+{
+	long n;
+	char *p = (char *)buffer;
+
+	while (size > 0)
+	{
+		if ((n = write(fd, p, size)) <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static void refuse(int client, const char *reason)
+{
+	char line[DAEMONLINE + 32];
+
+	sprintf(line, "error %s\n", reason);
+	writefull(client, line, strlen(line));
+}
+
+static int readline(Daemonclient& client)
+{
+	// Read what's arrived of a client's request:  1 once it's all there,
+	// up to its newline, 0 if there's more to come and -1 if the client's
+	// gone.
+
+	char buffer[DAEMONLINE];
+	int n, x;
+
+	if ((n = read(client.fd, buffer, sizeof(buffer))) <= 0)
+		return -1;
+	for (x = 0; x < n; x++)
+	{
+		if (buffer[x] == '\n')
+		{
+			client.line[client.length] = 0;
+			return 1;
+		}
+		if ((buffer[x] != '\r') && (client.length < DAEMONLINE - 1))
+			client.line[client.length++] = buffer[x];
+	}
+	return 0;
+}
+
+static Boolean numbers(int count, FP *value)
+{
+	// The next count words of a request, which should be numbers.
+
+	char *word, *end;
+	int x;
+
+	for (x = 0; x < count; x++)
+	{
+		if ((word = strtok(NULL, " \t")) == NULL)
+			return false;
+		value[x] = strtod(word, &end);
+		if (*end != 0)
+			return false;
+	}
+	return true;
+}
+
+static void regionpilots(int x0, int y0, int x1, int y1)
+{
+	// The pilot samples of the region's columns, and those beside it.
+
+	x0 = max(x0, regionx0 - 1);
+	x1 = min(x1, regionx1 + 1);
+	if (x0 < x1)
+		renderpilots(max(x0, 0), y0, min(x1, hres), y1);
+}
+
+static void regiontile(int x0, int y0, int x1, int y1)
+{
+	// Render the part of a tile that's in the region.  Called on every
+	// rendering thread.
+
+	int x, y;
+	Color pcolors[TILESIZE];
+
+	x0 = max(x0, regionx0);
+	x1 = min(x1, regionx1);
+	for (y = y0; (y < y1) && (x0 < x1); y++)
+	{
+		renderpixels(x0, y, x1 - x0, pcolors);
+		for (x = x0; x < x1; x++)
+			storepixel(&image[(y * hres + x) * bytes_per_pixel], pcolors[x - x0]);
+	}
+	flushstats();
+}
+
+static void renderrequest(int client, char *request)
+{
+	// A render process:  render the region asked for, on this process's
+	// copy of the scene, and send it back a band at a time.
+
+	char *word, line[80];
+	int x0, y0, x1, y1, y, band, end, threads;
+	FP value[6];
+	Point location;
+	Vector direction;
+
+	x0 = 0;
+	y0 = startingline;
+	x1 = hres;
+	y1 = numlines - startingline;
+
+	strtok(request, " \t");		// Skip "render" and the scene's name.
+	strtok(NULL, " \t");
+	while ((word = strtok(NULL, " \t")) != NULL)
+	{
+		if ((strcmp(word, "camera") == 0) && (numbers(6, value) == true))
+		{
+			location.init(value[0], value[1], value[2]);
+			direction.init(value[3], value[4], value[5]);
+			if (setcamera(location, direction) == false)
+			{
+				refuse(client, "the view and up directions are identical");
+				return;
+			}
+		}
+		else if ((strcmp(word, "region") == 0) && (numbers(4, value) == true))
+		{
+			x0 = (int)value[0];
+			y0 = (int)value[1];
+			x1 = (int)value[2];
+			y1 = (int)value[3];
+		}
+		else if ((strcmp(word, "supersample") == 0) && (numbers(1, value) == true))
+			supersample = (int)value[0];
+		else if ((strcmp(word, "frame") == 0) && (numbers(1, value) == true))
+			framenumber = (int)value[0];
+		else
+		{
+			refuse(client, "the request isn't understood");
+			return;
+		}
+	}
+
+	if ((x0 < 0) || (x1 > hres) || (x0 >= x1) ||
+	(y0 < startingline) || (y1 > numlines - startingline) || (y0 >= y1))
+	{
+		refuse(client, "the region isn't in the image");
+		return;
+	}
+	if ((supersample < 0) || (supersample > 3))
+	{
+		refuse(client, "the supersampling code isn't 0 to 3");
+		return;
+	}
+	if (!(image = new unsigned char[hres * vres * bytes_per_pixel]) ||
+	((supersample == 3) && !(pilot = new Color[hres * vres * PILOTSAMPLES])))
+	{
+		refuse(client, "there isn't enough memory for the image");
+		return;
+	}
+
+	sprintf(line, "ok %d %d %d\n", x1 - x0, y1 - y0, bytes_per_pixel);
+	if (writefull(client, line, strlen(line)) == false)
+		return;
+
+	// The threads are shared between the render processes running now.
+
+	threads = max(numberOfThreads / max(rendering->load(), 1), 1);
+	regionx0 = x0;
+	regionx1 = x1;
+	starttiles(threads);
+	if (supersample == 3)
+		rendertiles(hres, max(y0 - 1, startingline),
+		min(y1 + 1, numlines - startingline), regionpilots);
+
+	for (band = y0; band < y1; band = end)
+	{
+		end = min(band + TILESIZE, y1);
+		rendertiles(hres, band, end, regiontile);
+		for (y = band; y < end; y++)
+		{
+			if (writefull(client, &image[(y * hres + x0) * bytes_per_pixel],
+			(long)(x1 - x0) * bytes_per_pixel) == false)
+				break;
+		}
+		if (y < end)
+			break;		// The client's gone.
+	}
+	stoptiles();
+}
+
+static int receiverequest(int fd, char *request, int flags)
+{
+	// A scene process's next request, and the client's socket (-1 when the
+	// daemon lets it go, or, with MSG_DONTWAIT in flags, if there's none).
+
+	struct msghdr message;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(sizeof(int))];
+	int client;
+
+	memset(&message, 0, sizeof(message));
+	iov.iov_base = request;
+	iov.iov_len = DAEMONLINE;
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+	if (recvmsg(fd, &message, flags) <= 0)
+		return -1;
+	if (((cmsg = CMSG_FIRSTHDR(&message)) == NULL) || (cmsg->cmsg_type != SCM_RIGHTS))
+		return -1;
+	memcpy(&client, CMSG_DATA(cmsg), sizeof(int));
+	request[DAEMONLINE - 1] = 0;
+	return client;
+}
+
+static Boolean sendrequest(int fd, int client, char *request)
+{
+	// Pass a request, and the client's socket, to a scene process.
+
+	struct msghdr message;
+	struct iovec iov;
+	struct cmsghdr *cmsg;
+	char control[CMSG_SPACE(sizeof(int))];
+
+	memset(&message, 0, sizeof(message));
+	memset(control, 0, sizeof(control));
+	iov.iov_base = request;
+	iov.iov_len = DAEMONLINE;
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+
+	cmsg = CMSG_FIRSTHDR(&message);
+	cmsg->cmsg_level = SOL_SOCKET;
+	cmsg->cmsg_type = SCM_RIGHTS;
+	cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+	memcpy(CMSG_DATA(cmsg), &client, sizeof(int));
+
+	return (sendmsg(fd, &message, 0) == DAEMONLINE) ? true : false;
+}
+
+static void loadfailed(void)
+{
+	// Called at exit:  if the scene process is leaving because its scene
+	// couldn't be loaded, tell the clients waiting for it.  (Any request
+	// sent after this finds the socket closed, and the daemon refuses it.)
+
+	char request[DAEMONLINE];
+	int client;
+
+	if (loadingfd < 0)
+		return;
+	while ((client = receiverequest(loadingfd, request, MSG_DONTWAIT)) >= 0)
+	{
+		refuse(client, "the scene cannot be loaded");
+		close(client);
+	}
+	close(loadingfd);
+}
+
+static void sceneprocess(int fd, char *sdfname, int accelopt)
+{
+	// A scene process's life:  load the scene, then fork a render process
+	// for each request, until the daemon lets it go.
+
+	char request[DAEMONLINE];
+	int client, pid;
+
+	loadingfd = fd;
+	atexit(loadfailed);
+	preparescene(sdfname, accelopt);
+	loadingfd = -1;
+	printf("%s is loaded.\n\n", sdfname);
+
+	while ((client = receiverequest(fd, request, 0)) >= 0)
+	{
+		fflush(stdout);
+		if ((pid = fork()) == 0)		// The render process
+		{
+			close(fd);
+			(*rendering)++;
+			renderrequest(client, request);
+			(*rendering)--;
+			_exit(0);
+		}
+		if (pid == -1)
+			refuse(client, "a render process cannot be started");
+		close(client);
+	}
+	freeScene();
+	_exit(0);
+}
+
+static void dropscene(int s)
+{
+	// Let a scene process go;  it exits when its render processes have
+	// the requests they're rendering.
+
+	close(scenes[s].fd);
+	scenes[s].pid = 0;
+}
+
+static void startscene(int s, char *sdfname, int accelopt)
+{
+	int fds[2], x;
+
+	if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) != 0)
+	{
+		printf("\nA socket for a scene process cannot be created.\n");
+		exit(1);
+	}
+	fflush(stdout);		// (So the scene process doesn't repeat what's buffered.)
+
+	if ((scenes[s].pid = fork()) == -1)
+	{
+		printf("\nA scene process cannot be started.\n");
+		exit(1);
+	}
+	if (scenes[s].pid == 0)		// The new scene process
+	{
+		close(fds[0]);
+		close(listener);
+		for (x = 0; x < DAEMONSCENES; x++)
+		{
+			if ((x != s) && (scenes[x].pid != 0))
+				close(scenes[x].fd);
+		}
+		for (x = 0; x < numberOfClients; x++)
+			close(clients[x].fd);	// (Else they'd never see the end of the reply.)
+		sceneprocess(fds[1], sdfname, accelopt);
+	}
+	close(fds[1]);
+	scenes[s].fd = fds[0];
+}
+
+static int findscene(unsigned int hash, char *sdfname, int accelopt, long request)
+{
+	// The scene process for a scene, started if there isn't one yet.
+
+	int s, oldest = 0;
+
+	for (s = 0; s < DAEMONSCENES; s++)
+	{
+		if ((scenes[s].pid != 0) && (scenes[s].hash == hash))
+		{
+			scenes[s].used = request;
+			return s;
+		}
+		if ((scenes[s].pid == 0) ||
+		((scenes[oldest].pid != 0) && (scenes[s].used < scenes[oldest].used)))
+			oldest = s;
+	}
+
+	if (scenes[oldest].pid != 0)
+		dropscene(oldest);
+	startscene(oldest, sdfname, accelopt);
+	scenes[oldest].hash = hash;
+	scenes[oldest].used = request;
+	return oldest;
+}
+
+static unsigned int filehash(char *sdfname, struct stat& status)
+{
+	// The hash of a scene description file, from the scene loaded from it
+	// if the file hasn't changed since (0 if it can't be read).
+
+	int s;
+
+	if (stat(sdfname, &status) != 0)
+		return 0;
+	for (s = 0; s < DAEMONSCENES; s++)
+	{
+		if ((scenes[s].pid != 0) && (strcmp(scenes[s].name, sdfname) == 0) &&
+		(scenes[s].size == (long)status.st_size) && (scenes[s].mtime == (long)status.st_mtim.tv_sec) &&
+		(scenes[s].mtimensec == (long)status.st_mtim.tv_nsec))
+			return scenes[s].hash;
+	}
+	return hashfile(sdfname);
+}
+
+static Boolean handlerequest(int client, char *request, int accelopt, long requests)
+{
+	// Act on a client's request:  pass it to its scene's process, or
+	// refuse it.  True if it's "stop".
+
+	char sdfname[DAEMONLINE + 8];
+	struct stat status;
+	unsigned int hash;
+	int s;
+
+	sdfname[0] = 0;
+	sscanf(request, "%*s %s", sdfname);
+	if (strcmp(request, "stop") == 0)
+	{
+		writefull(client, (void *)"ok\n", 3);
+		return true;
+	}
+	if ((strncmp(request, "render ", 7) != 0) || (sdfname[0] == 0))
+	{
+		refuse(client, "the request isn't understood");
+		return false;
+	}
+
+	if ((strlen(sdfname) < 4) || (strcmp(&sdfname[strlen(sdfname) - 4], ".sdb") != 0))
+		strcat(sdfname, ".sdf");	// (A compiled scene is named in full.)
+	if ((hash = filehash(sdfname, status)) == 0)
+	{
+		refuse(client, "the scene description file cannot be read");
+		return false;
+	}
+
+	// A scene process that's died is noticed here, and started again.
+
+	s = findscene(hash, sdfname, accelopt, requests);
+	if (sendrequest(scenes[s].fd, client, request) == false)
+	{
+		dropscene(s);
+		s = findscene(hash, sdfname, accelopt, requests);
+		if (sendrequest(scenes[s].fd, client, request) == false)
+			refuse(client, "the scene cannot be loaded");
+	}
+	strcpy(scenes[s].name, sdfname);
+	scenes[s].size = (long)status.st_size;
+	scenes[s].mtime = (long)status.st_mtim.tv_sec;
+	scenes[s].mtimensec = (long)status.st_mtim.tv_nsec;
+	return false;
+}
+
+
+void renderdaemon(char *path, int accelopt)
+{
+	// Serve render requests on the Unix socket at path until a client asks
+	// the daemon to stop.  accelopt is as for preparescene.
+
+	struct sockaddr_un address;
+	struct pollfd fds[DAEMONCLIENTS + 1];
+	Boolean stop = false;
+	int client, s, x, done;
+	long requests = 0;
+
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(address.sun_path))
+	{
+		printf("The socket name %s is too long.\n\n", path);
+		exit(1);
+	}
+	strcpy(address.sun_path, path);
+	unlink(path);
+
+	if (((listener = socket(AF_UNIX, SOCK_STREAM, 0)) < 0) ||
+	(bind(listener, (struct sockaddr *)&address, sizeof(address)) != 0) ||
+	(listen(listener, 16) != 0))
+	{
+		printf("Cannot listen for render requests on %s.\n\n", path);
+		exit(1);
+	}
+
+	// The count of render processes is shared with every process forked.
+
+	rendering = (atomic<int> *)mmap(NULL, sizeof(atomic<int>), PROT_READ | PROT_WRITE,
+	MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (rendering == (atomic<int> *)MAP_FAILED)
+	{
+		printf("\nInsufficient memory to count the render processes.\n");
+		exit(1);
+	}
+	new (rendering) atomic<int>(0);
+
+	signal(SIGPIPE, SIG_IGN);	// (Clients that go away are noticed by write.)
+	signal(SIGCHLD, SIG_IGN);	// (Finished processes needn't be waited for.)
+	for (s = 0; s < DAEMONSCENES; s++)
+		scenes[s].pid = 0;
+	printf("Waiting for render requests on %s.\n\n", path);
+
+	while (stop == false)
+	{
+		fds[0].fd = listener;
+		fds[0].events = POLLIN;
+		for (x = 0; x < numberOfClients; x++)
+		{
+			fds[x + 1].fd = clients[x].fd;
+			fds[x + 1].events = POLLIN;
+		}
+		if (poll(fds, numberOfClients + 1, -1) <= 0)
+			continue;
+
+		// Read what's arrived from each client, and act on each request
+		// that's complete.  (A finished client is replaced by the last.)
+
+		for (x = numberOfClients - 1; (x >= 0) && (stop == false); x--)
+		{
+			if (fds[x + 1].revents == 0)
+				continue;
+			if ((done = readline(clients[x])) == 0)
+				continue;
+			if (done == 1)
+				stop = handlerequest(clients[x].fd, clients[x].line, accelopt, ++requests);
+			close(clients[x].fd);
+			clients[x] = clients[--numberOfClients];
+		}
+
+		if ((stop == false) && ((fds[0].revents & POLLIN) != 0) &&
+		((client = accept(listener, NULL, NULL)) >= 0))
+		{
+			if (numberOfClients == DAEMONCLIENTS)
+			{
+				refuse(client, "the daemon is busy");
+				close(client);
+			}
+			else
+			{
+				clients[numberOfClients].fd = client;
+				clients[numberOfClients].length = 0;
+				numberOfClients++;
+			}
+		}
+	}
+
+	for (x = 0; x < numberOfClients; x++)
+		close(clients[x].fd);
+	numberOfClients = 0;
+	for (s = 0; s < DAEMONSCENES; s++)
+	{
+		if (scenes[s].pid != 0)
+			dropscene(s);
+	}
+	munmap(rendering, sizeof(atomic<int>));
+	close(listener);
+	unlink(path);
+}
@@ -0,0 +1,33 @@
+// daemon.h		Serving render requests from scenes kept loaded between them
+
+#ifndef daemon_h
+#define daemon_h
+
+#define DAEMONSCENES 4		// Scenes kept loaded (the least recently used goes)
+#define DAEMONLINE 512		// The longest request line
+#define DAEMONCLIENTS 64	// Clients whose requests are still being read
+
+class Daemonscene		// The daemon's record of a loaded scene
+{
+	public:
+
+	unsigned int hash;		// The hash of its scene description file
+	char name[DAEMONLINE + 8];	// The file as it was last hashed:  its name,
+	long size, mtime, mtimensec;	// size and time of modification
+	int pid;				// The scene process's ID (0 if none)
+	int fd;					// The daemon's end of its socket
+	long used;				// When it was last asked for (a request count)
+};
+
+class Daemonclient		// A client whose request is still being read
+{
+	public:
+
+	int fd;					// Its socket
+	int length;				// The characters of the request read so far
+	char line[DAEMONLINE];
+};
+
+void renderdaemon(char *path, int accelopt);
+
+#endif	// Of daemon_h
@@ -0,0 +1,270 @@
+// farm.cc		Rendering the image's tiles in worker processes
+
+#include <atomic>				// (Must precede raytrace.h's min & max.)
+#include "platform.h"
+#include "raytrace.h"
+#include "tiles.h"
+#include "farm.h"
+#include <unistd.h>				// fork, read, write
+#include <signal.h>
+#include <poll.h>
+#include <sys/socket.h>			// socketpair
+#include <sys/wait.h>			// waitpid
+
+// The coordinator forks the workers after the scene is loaded and its
+// acceleration structure built, so each worker starts with its own copy of
+// both.  Each worker has a Unix socket to the coordinator, which sends it
+// a tile number;  the worker renders the tile and sends its pixels back,
+// and is then sent the next tile.  A tile number of -1 tells a worker to
+// send its ray statistics and exit.  If a worker dies, the tile it had is
+// given to another worker and a new worker is forked in its place.
+
+extern int hres, bytes_per_pixel, startingline, numlines, display;
+extern unsigned char *image, *tiledone;
+extern int tilecolumns, tilecount;
+extern atomic<int> tilesdone;
+extern atomic<long> totalshadowrays, totalblocked, totalcachehits, totalprimary;
+
+void farmtile(int x0, int y0, int x1, int y1);
+void finishtile(int tile);
+long *farmstats(void);
+
+static Farmworker *workerptr;
+static int numberOfWorkers;
+static int *queue, queued;		// Tiles waiting for a worker (a stack)
+static int *tries;				// Workers lost on each tile
+
+static Boolean readfull(int fd, void *buffer, long size)
+{
+	long n;
+	char *p = (char *)buffer;
+
+	while (size > 0)
+	{
+		if ((n = read(fd, p, size)) <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static Boolean writefull(int fd, void *buffer, long size)
+{
+	long n;
+	char *p = (char *)buffer;
+
+	while (size > 0)
+	{
+		if ((n = write(fd, p, size)) <= 0)
+			return false;
+		p += n;
+		size -= n;
+	}
+	return true;
+}
+
+static void tileextents(int tile, int& x0, int& y0, int& x1, int& y1)
+{
+	x0 = (tile % tilecolumns) * TILESIZE;
+	y0 = startingline + (tile / tilecolumns) * TILESIZE;
+	x1 = min(x0 + TILESIZE, hres);
+	y1 = min(y0 + TILESIZE, numlines - startingline);
+}
+
+static void farmworker(int fd)
+{
+	// A worker's life:  render the tiles it's sent, until told to stop.
+
+	int tile, x0, y0, x1, y1, y;
+
+	while (readfull(fd, &tile, sizeof(int)) == true)
+	{
+		if (tile == -1)
+		{
+			writefull(fd, farmstats(), 4 * sizeof(long));
+			break;
+		}
+		tileextents(tile, x0, y0, x1, y1);
+		farmtile(x0, y0, x1, y1);
+
+		if (writefull(fd, &tile, sizeof(int)) == false)
+			break;
+		for (y = y0; y < y1; y++)
+		{
+			if (writefull(fd, &image[(y * hres + x0) * bytes_per_pixel],
+			(long)(x1 - x0) * bytes_per_pixel) == false)
+				break;
+		}
+	}
+	_exit(0);
+}
+
+static void startworker(int w)
+{
+	int fds[2], x;
+
+	if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+	{
+		printf("\nA socket for a worker process cannot be created.\n");
+		exit(1);
+	}
+	fflush(stdout);		// (So the worker doesn't repeat what's buffered.)
+
+	if ((workerptr[w].pid = fork()) == -1)
+	{
+		printf("\nA worker process cannot be started.\n");
+		exit(1);
+	}
+	if (workerptr[w].pid == 0)	// The new worker
+	{
+		close(fds[0]);
+		for (x = 0; x < numberOfWorkers; x++)
+		{
+			if ((x != w) && (workerptr[x].pid != 0))
+				close(workerptr[x].fd);
+		}
+		farmworker(fds[1]);
+	}
+	close(fds[1]);
+	workerptr[w].fd = fds[0];
+	workerptr[w].tile = -1;
+}
+
+static void assign(int w)
+{
+	// Send worker w the next tile, or tell it to stop if there are none.
+
+	int tile;
+	long stats[4];
+
+	tile = (queued > 0) ? queue[--queued] : -1;
+	workerptr[w].tile = tile;
+	if (writefull(workerptr[w].fd, &tile, sizeof(int)) == false)
+		return;		// It's died;  poll will find out.
+
+	if (tile == -1)	// Collect its statistics and let it go
+	{
+		if (readfull(workerptr[w].fd, stats, 4 * sizeof(long)) == true)
+		{
+			totalshadowrays += stats[0];
+			totalblocked += stats[1];
+			totalcachehits += stats[2];
+			totalprimary += stats[3];
+		}
+		close(workerptr[w].fd);
+		waitpid(workerptr[w].pid, NULL, 0);
+		workerptr[w].pid = 0;
+	}
+}
+
+static void lostworker(int w)
+{
+	// Worker w died:  put its tile back in the queue and replace it.
+
+	int tile = workerptr[w].tile;
+
+	close(workerptr[w].fd);
+	waitpid(workerptr[w].pid, NULL, 0);
+	printf("\nWorker process %d died while rendering tile %d.\n", workerptr[w].pid, tile);
+	workerptr[w].pid = 0;
+
+	if (tile >= 0)
+	{
+		if (++tries[tile] >= FARMRETRIES)
+		{
+			printf("Tile %d has killed %d workers.  Giving up...\n\n", tile, tries[tile]);
+			exit(1);
+		}
+		queue[queued++] = tile;
+	}
+	startworker(w);
+	assign(w);
+}
+
+
+void renderfarm(int workers)
+{
+	// Render every tile not already finished, on workers processes, and
+	// return when they're all in the image.
+
+	struct pollfd *fds;
+	int x, w, tile, x0, y0, x1, y1, y, remaining, done;
+	Boolean ok;
+
+	numberOfWorkers = workers;
+	if (!(workerptr = new Farmworker[workers]) || !(fds = new pollfd[workers]) ||
+	!(queue = new int[tilecount + 1]) || !(tries = new int[tilecount + 1]))
+	{
+		printf("\nInsufficient memory to start the worker processes.\n");
+		exit(1);
+	}
+
+	queued = 0;		// Queue the tiles in reverse, so they're taken in order.
+	for (x = tilecount - 1; x >= 0; x--)
+	{
+		tries[x] = 0;
+		if (tiledone[x] == 0)
+			queue[queued++] = x;
+	}
+	remaining = queued;
+
+	signal(SIGPIPE, SIG_IGN);	// A dead worker's socket is noticed by poll.
+	for (w = 0; w < workers; w++)
+		workerptr[w].pid = 0;
+	for (w = 0; w < workers; w++)
+		startworker(w);
+	for (w = 0; w < workers; w++)
+		assign(w);
+
+	while (remaining > 0)
+	{
+		for (w = 0; w < workers; w++)
+		{
+			fds[w].fd = (workerptr[w].pid != 0) ? workerptr[w].fd : -1;
+			fds[w].events = POLLIN;
+			fds[w].revents = 0;
+		}
+		if (poll(fds, workers, -1) < 0)
+			continue;	// (Interrupted by a signal.)
+
+		for (w = 0; w < workers; w++)
+		{
+			if ((fds[w].revents == 0) || (workerptr[w].pid == 0))
+				continue;
+
+			ok = readfull(workerptr[w].fd, &tile, sizeof(int)) && (tile == workerptr[w].tile);
+			if (ok == true)
+			{
+				tileextents(tile, x0, y0, x1, y1);
+				for (y = y0; (ok == true) && (y < y1); y++)
+					ok = readfull(workerptr[w].fd, &image[(y * hres + x0) * bytes_per_pixel],
+					(long)(x1 - x0) * bytes_per_pixel);
+			}
+			if (ok == false)
+			{
+				lostworker(w);
+				continue;
+			}
+
+			finishtile(tile);
+			remaining--;
+			done = ++tilesdone;
+			if ((display == 0) || (display == 3))
+				printf("Tiles finished: %d    \r", done);
+			assign(w);
+		}
+	}
+
+	for (w = 0; w < workers; w++)	// Stop any still waiting for work
+	{
+		if (workerptr[w].pid != 0)
+			assign(w);
+	}
+	signal(SIGPIPE, SIG_DFL);
+
+	delete [] workerptr;
+	delete [] fds;
+	delete [] queue;
+	delete [] tries;
+}
@@ -0,0 +1,19 @@
+// farm.h		Rendering the image's tiles in worker processes
+
+#ifndef farm_h
+#define farm_h
+
+#define FARMRETRIES 3		// Workers that may die on one tile before giving up
+
+class Farmworker		// The coordinator's record of a worker process
+{
+	public:
+
+	int pid;			// Its process ID (0 if it isn't running)
+	int fd;				// The coordinator's end of its socket
+	int tile;			// The tile it's rendering (-1 if none)
+};
+
+void renderfarm(int workers);
+
+#endif	// Of farm_h
@@ -9,6 +9,10 @@ Light::Light(void)
 {
 }
 
+Light::~Light(void)
+{
+}
+
 
 // Point light source	************************************************
 
@@ -11,6 +11,7 @@ class Light		// An abstract class
 	Color color;
 
 	Light(void);
+	virtual ~Light(void);
 	
 	// This pure virtual function is a placeholder for Light's children...
 	
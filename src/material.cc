@@ -0,0 +1,195 @@
+// material.cc	The materials:  surfaces kept once, for the objects to share
+
+#include <mutex>			// (Must precede raytrace.h's min & max.)
+#include "platform.h"
+#include "raytrace.h"
+#include "vector.h"		// Vector-related objects and functions
+#include "miscobj.h"		// Miscellaneous objects
+#include "object.h"		// Object abstract-class definition
+#include "scene.h"		// makeroom
+#include "material.h"
+
+// An object refers to its surface by its place in the material table, as
+// does the Node for a point on it;  the surface itself is only there.
+// Material 0 is the background's.  A 252 record in a scene description
+// adds the next material (1, 2, ...), and an object may give -m in place
+// of its surface to use material m.  A surface written out in full is
+// looked up among those read so far, so every object with the same one
+// shares it.  Once the scene is read, finishmaterials() adds them to the
+// table after the 252 records' materials, in the order the objects first
+// use them (the same order whichever threads read the objects).
+
+extern int numberOfObjects, numberOfMaterials;
+extern Object **objptr;
+extern Surface *materials;
+
+static mutex surfacelock;		// (The objects may be read on every core.)
+static Surface *surfaces = NULL;	// The surfaces written out in full
+static int numberOfSurfaces = 0, surfacespace = 0;
+static int *surfacehash = NULL;	// Places in surfaces (-1 = empty slot)
+static int hashspace = 0;
+static int generation = 0;		// Counts the scenes read
+
+
+static Boolean samesurface(Surface& a, Surface& b)
+{
+	return ((a.texture == b.texture) && (a.kdiff == b.kdiff) &&
+	(a.kspec == b.kspec) && (a.ktran == b.ktran) && (a.n == b.n) &&
+	(a.color.r == b.color.r) && (a.color.g == b.color.g) && (a.color.b == b.color.b));
+}
+
+static unsigned int hashsurface(Surface& s)
+{
+	// A 32-bit FNV-1a hash of the fields samesurface() compares.
+
+	FP fields[7] = {s.kdiff, s.kspec, s.ktran, s.n, s.color.r, s.color.g, s.color.b};
+	unsigned char *p = (unsigned char *)fields;
+	unsigned int hash = 2166136261U ^ (unsigned int)s.texture;
+	int x;
+
+	for (x = 0; x < (int)sizeof(fields); x++)
+		hash = (hash ^ p[x]) * 16777619U;
+	return hash;
+}
+
+
+static void rehash(void)
+{
+	int place, slot;
+
+	free(surfacehash);
+	hashspace = (hashspace == 0) ? 64 : hashspace * 2;
+	if (!(surfacehash = (int *)malloc(hashspace * sizeof(int))))
+	{
+		printf("\nInsufficient memory for the surfaces' hash table.\n");
+		exit(1);
+	}
+	for (slot = 0; slot < hashspace; slot++)
+		surfacehash[slot] = -1;
+	for (place = 0; place < numberOfSurfaces; place++)
+	{
+		slot = hashsurface(surfaces[place]) & (hashspace - 1);
+		while (surfacehash[slot] >= 0)
+			slot = (slot + 1) & (hashspace - 1);
+		surfacehash[slot] = place;
+	}
+}
+
+static int findsurface(Surface& surface)
+{
+	// The place in surfaces of one like surface, added if it's new.  Most
+	// objects are like the last one, so each thread remembers that.
+
+	static thread_local Surface last;
+	static thread_local int lastplace = -1, lastgeneration;
+	int place, slot;
+
+	if ((lastplace >= 0) && (lastgeneration == generation) && samesurface(surface, last))
+		return lastplace;
+	{
+		lock_guard<mutex> lock(surfacelock);
+
+		if (2 * (numberOfSurfaces + 1) > hashspace)
+			rehash();
+		slot = hashsurface(surface) & (hashspace - 1);
+		while (((place = surfacehash[slot]) >= 0) && !samesurface(surfaces[place], surface))
+			slot = (slot + 1) & (hashspace - 1);
+		if (place < 0)
+		{
+			if (numberOfSurfaces == surfacespace)
+			{
+				surfacespace = (surfacespace == 0) ? 64 : surfacespace * 2;
+				if (!(surfaces = (Surface *)realloc(surfaces, surfacespace * sizeof(Surface))))
+				{
+					printf("\nInsufficient memory for the objects' surfaces.\n");
+					exit(1);
+				}
+			}
+			surfaces[numberOfSurfaces] = surface;
+			surfacehash[slot] = place = numberOfSurfaces++;
+		}
+	}
+	last = surface;
+	lastplace = place;
+	lastgeneration = generation;
+	return place;
+}
+
+
+istream& readmaterial(istream& s, int& material)
+{
+	// Read an object's surface:  -m, for material m, or the surface in full.
+	// Until finishmaterials() the latter leaves -1 - its place in surfaces.
+
+	Surface surface;
+
+	s >> surface.texture;
+	if (namesmaterial(surface.texture) == true)
+	{
+		material = -surface.texture;
+		return s;
+	}
+	s >> surface.kdiff >> surface.kspec >> surface.ktran >> surface.n >> surface.color;
+	surface.in = 1.0 / surface.n;
+	material = -1 - findsurface(surface);
+	return s;
+}
+
+ostream& writematerial(ostream& s, int material)
+{
+	// (saveScene() writes materials 1 on as 252 records.)
+
+	if (material == 0)
+		s << materials[0];
+	else
+		s << -material << "\n";
+	return s;
+}
+
+
+void finishmaterials(void)
+{
+	// Settle the materials of the objects just read:  put the surfaces
+	// read in full in the table, and check that the materials referred to
+	// exist.
+
+	int defined = numberOfMaterials, *place = NULL, m, x;
+
+	if ((numberOfSurfaces > 0) && !(place = new int[numberOfSurfaces]))
+	{
+		printf("\nInsufficient memory to number the materials.\n");
+		exit(1);
+	}
+	for (x = 0; x < numberOfSurfaces; x++)
+		place[x] = -1;
+
+	for (x = 0; x < numberOfObjects; x++)
+	{
+		m = objptr[x]->material;
+		if (m < 0)
+		{
+			if (place[-1 - m] < 0)
+			{
+				makeroom(0, 0, 0, numberOfMaterials + 1);
+				materials[numberOfMaterials] = surfaces[-1 - m];
+				place[-1 - m] = numberOfMaterials++;
+			}
+			objptr[x]->material = place[-1 - m];
+		}
+		else
+		if (m >= defined)
+		{		// Then, the material index is invalid - reset to the default.
+			printf("\nError in object %d:  The material index (%d) is invalid (>= %d).\n", x, m, defined);
+			printf("This object will be given the default material.\n");
+			objptr[x]->material = 0;
+		}
+	}
+
+	delete [] place;
+	free(surfaces);
+	free(surfacehash);
+	surfaces = NULL;
+	surfacehash = NULL;
+	numberOfSurfaces = surfacespace = hashspace = 0;
+	generation++;
+}
@@ -0,0 +1,18 @@
+// material.h	The materials:  surfaces kept once, for the objects to share
+
+#ifndef material_h
+#define material_h
+
+inline Boolean namesmaterial(long texture)
+{
+	// Whether an object's surface, which starts with this, is -m for
+	// material m rather than a surface in full.  ("-0" isn't.)
+
+	return (texture < 0) ? true : false;
+}
+
+istream& readmaterial(istream& s, int& material);
+ostream& writematerial(ostream& s, int material);
+void finishmaterials(void);
+
+#endif	// Of material_h
@@ -148,12 +148,13 @@ Node::Node(void)
 	entering = true;
 }
 
-void Node::init(Point ipoi, Vector inormal, Surface isurface, Ray itr, Ray irr,
-Node *itp, Node *irp, Boolean itflag, Boolean irflag, Boolean ienter)
+void Node::init(Point ipoi, Vector inormal, int imaterial, Color& icolor, Ray itr,
+Ray irr, Node *itp, Node *irp, Boolean itflag, Boolean irflag, Boolean ienter)
 {
 	poi = ipoi;
 	normal = inormal;
-	surface = isurface;
+	material = imaterial;
+	color = icolor;
 	transmitted = itr;
 	reflected = irr;
 	tptr = itp;
@@ -162,3 +163,47 @@ Node *itp, Node *irp, Boolean itflag, Boolean irflag, Boolean ienter)
 	rflag = irflag;
 	entering = ienter;
 }
+
+
+NodeArena::NodeArena(void)
+{
+	chunks = NULL;
+	numberOfChunks = 0;
+	maxChunks = 0;
+	used = 0;
+}
+
+NodeArena::~NodeArena(void)
+{
+	int x;
+
+	for (x = 0; x < numberOfChunks; x++)
+		delete [] chunks[x];
+	delete [] chunks;
+}
+
+void NodeArena::grow(void)	// Add a chunk of nodes
+{
+	Node **newchunks;
+	int x;
+
+	if (numberOfChunks == maxChunks)
+	{
+		maxChunks = (maxChunks == 0) ? 16 : maxChunks * 2;
+		if (!(newchunks = new Node *[maxChunks]))
+		{
+			printf("\nInsufficient memory to grow the node arena.\n");
+			exit(1);
+		}
+		for (x = 0; x < numberOfChunks; x++)
+			newchunks[x] = chunks[x];
+		delete [] chunks;
+		chunks = newchunks;
+	}
+	if (!(chunks[numberOfChunks] = new Node[ARENACHUNK]))
+	{
+		printf("\nInsufficient memory to allocate a chunk of ray nodes.\n");
+		exit(1);
+	}
+	numberOfChunks++;
+}
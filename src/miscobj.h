@@ -1,5 +1,5 @@
 // miscobj.h	Miscellaneous object class definitions
-// (Color, Point, Surface, Ray, Node)
+// (Color, Point, Surface, Ray, Node, NodeArena)
 // J. O'Sullivan
 
 #ifndef miscobjects_h
@@ -252,9 +252,11 @@ class Node
 
 	Vector normal;
 
-// 	The poi surface & material characteristics:
+// 	The poi's material (its place in the material table), and its color:
+//	the material's, or its texture's there, until the point is shaded:
 
-	Surface surface;
+	int material;
+	Color color;
 
 //	The pointers to the next two branches on the tree:
 
@@ -278,12 +280,57 @@ class Node
 
 	Node(void);
 
-	void init(Point ipoi, Vector inormal, Surface isurface, Ray itr,
-	Ray irr, Node *itp, Node *irp, Boolean itflag, Boolean irflag,
+	void init(Point ipoi, Vector inormal, int imaterial, Color& icolor,
+	Ray itr, Ray irr, Node *itp, Node *irp, Boolean itflag, Boolean irflag,
 	Boolean ienter);
 };
 
 
+#define ARENACHUNK 64		// Nodes per NodeArena chunk
+
+class NodeArena
+{
+// Hands out the nodes of the intersection tree for one sample at a time.
+// The nodes come from chunks that are kept for the life of the arena, so
+// resetting it for the next sample just rewinds the count.
+
+	public:
+
+	Node **chunks;		// The chunks of ARENACHUNK nodes
+	int numberOfChunks;
+	int maxChunks;		// The size of the chunks array
+	int used;			// Nodes handed out since the last reset
+
+	NodeArena(void);
+	~NodeArena(void);
+
+	Node *alloc(void)	// A node in the same state as a newly constructed one
+	{
+		Node *nodeptr;
+
+		if (used == numberOfChunks * ARENACHUNK)
+			grow();
+		nodeptr = &chunks[used / ARENACHUNK][used % ARENACHUNK];
+		used++;
+		nodeptr->tflag = false;
+		nodeptr->rflag = false;
+		nodeptr->entering = true;
+		return nodeptr;
+	}
+	void reset(void)	// Frees every node at once
+	{
+		used = 0;
+	}
+	Node *slot(int n)	// The nth node, for a caller that keeps one per level
+	{
+		while (n >= numberOfChunks * ARENACHUNK)
+			grow();
+		return &chunks[n / ARENACHUNK][n % ARENACHUNK];
+	}
+	void grow(void);
+};
+
+
 class Interdata
 {
 	public:
@@ -9,7 +9,7 @@ class Object       // An abstract class.
 	public:
 
 	Vector normal;
-	Surface surface;
+	int material;	// Its surface:  its place in the material table
 
 	virtual Boolean icheck(Ray& aray, Interdata& id) = 0;
 	virtual void intersect(Ray& aray, Node  *nodeptr, Interdata& id) = 0;
@@ -1,5 +1,7 @@
 // Octree.cc    Octree-related functions    J. O'Sullivan   9/27/1993
 
+#include <thread>			// (These two must precede raytrace.h's min & max.)
+#include <atomic>
 #include "raytrace.h"
 #include "vector.h"
 #include "miscobj.h"
@@ -8,189 +10,294 @@
 #include "planar.h"
 #include "quadric.h"
 #include "octree.h"
+#include "bvh.h"
+#include "pool.h"			// icheckhandle, handleobject
+#include "spheres.h"		// nearestsphere
 
 // Note: rootvoxel is ALWAYS empty - it never has any objects in it.
 // It's always subdivided.
 
-Object *checktree(Ray& ray, Interdata& idn)
+static unsigned int walkoctree(Ray& ray, Interdata& idn, FP maxt, Boolean anyhit);
+static atomic<int> freethreads(0);	// Build threads that may still be started
+
+static inline void pushchild(OctreeEntry& e, int children, int side[3], FP size,
+FP min[3], FP tn, FP tf)
 {
-	OctreeInterdata oid;
-	Point point;
+	// Fill in e with the child on the given sides of its parent's splitting
+	// planes.  Its min comes out exactly as setextents computes it.
 
-/*
-	printf("\nEntering checktree.  Ray:\n");
-	printf("%1.19e,%1.19e,%1.19e\n", ray.origin.x, ray.origin.y, ray.origin.z);
-	printf("%1.19e,%1.19e,%1.19e\n", ray.direction.dx, ray.direction.dy, ray.direction.dz);
-*/
+	int a;
 
-	// First, are we inside or outside the world box?
+	e.node = children + octant(side);
+	for (a = 0; a < 3; a++)
+		e.min[a] = (side[a] == 0) ? min[a] : min[a] + size;
+	e.size = size;
+	e.tn = tn;
+	e.tf = tf;
+}
 
-	if (!rootvoxel.inside(ray.origin))
-	{
-		// We're outside the world box.  Intersect with the world box:
 
-		if (rootvoxel.icheck(ray, oid) == true)
-		{
-			// Found an intersection with the world box.
-			// Next, find a point inside the world:
-			// First, determine which planes the poi is on.
-
-			if ((fabs(oid.poin.z - rootvoxel.min.z) < OTSIGMA) ||
-			(fabs(oid.poin.z - rootvoxel.max.z) < OTSIGMA))
-            {
-				if (ray.direction.dz < 0.0)
-					oid.normaln.dz = -1.0;
-				else
-					oid.normaln.dz = 1.0;
-            }
-			if ((fabs(oid.poin.x - rootvoxel.min.x) < OTSIGMA) ||
-			(fabs(oid.poin.x - rootvoxel.max.x) < OTSIGMA))
-			{
-                if (ray.direction.dx < 0.0)
-					oid.normaln.dx = -1.0;
-				else
-					oid.normaln.dx = 1.0;
-            }
+Object *checktree(Ray& ray, Interdata& idn)
+{
+	// Find the closest object hit by ray, using whichever structure was built.
 
-			if ((fabs(oid.poin.y - rootvoxel.min.y) < OTSIGMA) ||
-			(fabs(oid.poin.y - rootvoxel.max.y) < OTSIGMA))
-			{
-                if (ray.direction.dy < 0.0)
-					oid.normaln.dy = -1.0;
-				else
-					oid.normaln.dy = 1.0;
-			}
+	unsigned int handle;
 
-			// Compute a point inside the voxel.
+	if (accel == 1)
+		return checkbvh(ray, idn);
+	handle = walkoctree(ray, idn, HUGE_VAL, false);
+	return (handle != 0) ? handleobject(handle) : (Object *)NULL;
+}
 
-			point = oid.poin + VtoP(oid.normaln * minlen2);
 
-			return iterate(ray, findvoxel(&rootvoxel, point), idn);
-		}
-		else
-			return NULL;	// No intersection with the world.
+void checkpacket(Ray *rays, Interdata *idn, Object **hits, int count)
+{
+	// Find the closest object hit by each of count (up to PACKETSIZE) rays,
+	// as checktree would.  The BVH walks them together; in the octree they
+	// split apart at nearly every voxel, so each walks it alone.
+
+	unsigned int handles[PACKETSIZE];
+	int k;
+
+	if (accel == 1)
+	{
+		bvhpacket(rays, idn, handles, count);
+		for (k = 0; k < count; k++)
+			hits[k] = (handles[k] != 0) ? handleobject(handles[k]) : (Object *)NULL;
+		return;
 	}
-	else
+	for (k = 0; k < count; k++)
 	{
-		// We're inside the world box.  Find out which voxel we're in,
-		// then call the recursive intersect function iterate.
-
-		return iterate(ray, findvoxel(&rootvoxel, ray.origin), idn);
+		handles[k] = walkoctree(rays[k], idn[k], HUGE_VAL, false);
+		hits[k] = (handles[k] != 0) ? handleobject(handles[k]) : (Object *)NULL;
 	}
 }
 
 
-Object *iterate(Ray& ray, Voxel *voxel, Interdata& idn)
+unsigned int occluded(Ray& ray, FP maxt)
 {
-	int n;
+	// Returns the handle of an object that blocks ray closer than maxt (or
+	// 0 if none does) - for shadow rays.  The first blocking object found
+	// ends the search; it needn't be the nearest.
+
 	Interdata id;
-	OctreeInterdata oid;
-	FP closest = 9999999999.0;  // Distance to the closest object
-	Boolean iflag = false, intersection;
-	Object *closeptr;   // pointer to the object closest to the camera
-	Point point;
+	Boolean hit;
+	int n;
 
-/*
-	printf("\nEntering iterate.  Ray:\n");
-	printf("%1.19e,%1.19e,%1.19e\n", ray.origin.x, ray.origin.y, ray.origin.z);
-	printf("%1.19e,%1.19e,%1.19e\n", ray.direction.dx, ray.direction.dy, ray.direction.dz);
-	printf("\nVoxel min and max:\n");
-	printf("%1.19e,%1.19e,%1.19e\n", voxel->min.x, voxel->min.y, voxel->min.z);
-	printf("%1.19e,%1.19e,%1.19e\n", voxel->max.x, voxel->max.y, voxel->max.z);
-*/
+	if (use_octree == false)
+	{
+		for (n = 0; n < numberOfObjects; n++)
+		{
+			hit = icheckhandle(objhandle[n], ray, id);
+			if ((hit == true) && (id.t < maxt))
+				return objhandle[n];
+		}
+		return 0;
+	}
+	else if (accel == 1)
+		return bvhoccluded(ray, maxt);
+	else
+		return walkoctree(ray, id, maxt, true);
+}
 
-	// First, check the ray for intersection with all objects in this voxel.
-	// Store the intersection data in id, and return the pointer to the
-	// object if there is an intersection.
 
-	if (voxel->numberOfObjects > 0)	// Be sure this voxel isn't empty.
+static unsigned int walkoctree(Ray& ray, Interdata& idn, FP maxt, Boolean anyhit)
+{
+	// Walk the octree front-to-back along the ray.  Each stack entry holds a
+	// voxel and the parametric interval (tn, tf) over which the ray is inside
+	// it, so the next voxel is popped straight off the stack rather than
+	// searched for again from rootvoxel.  Voxels beyond maxt aren't visited.
+	// If anyhit is true, the first object hit before maxt is returned.  (The
+	// object's handle is returned, or 0 for none.)
+
+	OctreeEntry stack[OTSTACKSIZE], *entry;
+	OctreeInterdata oid;
+	Interdata id;
+	OctreeNode *node;
+	FP o[3], d[3], mid[3], ts[3], tn, tf, t, closest, size, min[3], max[3];
+	int side[3], order[3], sp, n, a, b, c, children, s;
+	Boolean intersection;
+	SphereRun *run;
+	unsigned int closeptr, handle;
+
+	if (rootvoxel.icheck(ray, oid) == false)
+		return 0;	// No intersection with the world.
+
+	o[0] = ray.origin.x;
+	o[1] = ray.origin.y;
+	o[2] = ray.origin.z;
+	d[0] = ray.direction.dx;
+	d[1] = ray.direction.dy;
+	d[2] = ray.direction.dz;
+
+	// If we're inside the world box, start at the ray origin.
+
+	stack[0].node = 0;
+	stack[0].min[0] = rootvoxel.min.x;
+	stack[0].min[1] = rootvoxel.min.y;
+	stack[0].min[2] = rootvoxel.min.z;
+	stack[0].size = rootvoxel.size;
+	stack[0].tn = (oid.tn > 0.0) ? oid.tn : 0.0;
+	stack[0].tf = oid.tf;
+	sp = 1;
+
+	while (sp > 0)
 	{
-		n = 0;
-		do    // Loop through all intersected objects in the scene
+		sp--;
+		entry = &stack[sp];
+		node = &octnodes[entry->node];
+		tn = entry->tn;
+		tf = entry->tf;
+		if (tn >= maxt)
+			return 0;	// The rest of the voxels are further still.
+
+		if (node->numberOfObjects >= 0)
 		{
-			do  // Loop through all objects until an intersection is found
-			{
-				intersection = (voxel->list[n])->icheck(ray, id);
-				n++;
-			}  while ((intersection == false) && (n < voxel->numberOfObjects));
+			// Check the ray for intersection with all objects in this voxel.
+			// If the closest intersection is inside the voxel, we're done.
+
+			for (a = 0; a < 3; a++)
+				max[a] = entry->min[a] + entry->size;
+			closest = 9999999999.0;
+			closeptr = 0;
 
-			// If this intersection is closer than any other, and
-			// if it is in the current voxel, then record it.
+			// The spheres the list starts with are tested a block at a time,
+			// nearest first, until one is hit inside the voxel.
 
-			if ((intersection == true) && (id.t < closest) &&
-			(id.poi > voxel->min) && (id.poi < voxel->max))
+			run = &sphereruns[entry->node];
+			t = 0.0;
+			while ((run->count > 0) &&
+			((s = nearestsphere(&sphereblocks[run->block], run->count, ray, t, t)) >= 0))
 			{
-				closeptr = voxel->list[n-1];
-				closest = id.t;
-				idn = id;
-				iflag = true;
+				if ((anyhit == true) && (t >= maxt))
+					break;
+				handle = octlist[node->offset + s];
+				if (((Sphere *)handleobject(handle))->Sphere::icheck(ray, id) == false)
+					continue;	// (Not quite hit, after all.)
+				if ((anyhit == true) && (id.t < maxt))
+					return handle;
+				if ((anyhit == false) && (id.poi.x > entry->min[0]) && (id.poi.y > entry->min[1]) &&
+				(id.poi.z > entry->min[2]) && (id.poi.x < max[0]) &&
+				(id.poi.y < max[1]) && (id.poi.z < max[2]))
+				{
+					closeptr = handle;
+					closest = id.t;
+					idn = id;
+					break;
+				}
+				if (t >= tf)
+					break;	// Any other sphere's hit is further out of the voxel.
 			}
-		}  while (n < voxel->numberOfObjects);
-	}
 
-	// If there is no intersection, compute the next voxel and iterate.
-	// If the ray passes out of the world, return null.
+			for (n = node->offset + run->count; n < node->offset + node->numberOfObjects; n++)
+			{
+				handle = octlist[n];
+				intersection = icheckhandle(handle, ray, id);
+				if ((anyhit == true) && (intersection == true) && (id.t < maxt))
+					return handle;
+				if ((intersection == true) && (id.t < closest) &&
+				(id.poi.x > entry->min[0]) && (id.poi.y > entry->min[1]) &&
+				(id.poi.z > entry->min[2]) && (id.poi.x < max[0]) &&
+				(id.poi.y < max[1]) && (id.poi.z < max[2]))
+				{
+					closeptr = handle;
+					closest = id.t;
+					idn = id;
+				}
+			}
+			if (closeptr != 0)
+				return closeptr;
+			continue;
+		}
 
-	if (iflag == true)	// If there's an intersection, return.
-		return closeptr;
-	else
-	{
-		// No intersection, move to the next voxel.
-		// To do this, compute the far poi:
+		// Find where the ray crosses this voxel's three splitting planes, and
+		// which side of each plane it's on when it enters the voxel.
 
-		if (voxel->icheck(ray, oid) == false)
+		size = entry->size / 2;
+		for (a = 0; a < 3; a++)
 		{
-			printf("Deep kimchee!\n");
-			exit(1);
+			min[a] = entry->min[a];		// (The entry is about to be reused.)
+			mid[a] = min[a] + size;
+
+			if (d[a] == 0.0)
+			{
+				ts[a] = HUGE_VAL;	// It never crosses this plane.
+				side[a] = (o[a] < mid[a]) ? 0 : 1;
+			}
+			else
+			{
+				ts[a] = (mid[a] - o[a]) / d[a];
+				if (ts[a] > tn)
+					side[a] = (d[a] > 0.0) ? 0 : 1;
+				else
+					side[a] = (d[a] > 0.0) ? 1 : 0;
+			}
+			order[a] = a;
 		}
 
-		// determine which plane(s) it's on:
+		// Sort the crossings by distance:
 
-		if ((fabs(oid.poif.z - voxel->min.z) < OTSIGMA) ||
-		(fabs(oid.poif.z - voxel->max.z) < OTSIGMA))
+		if (ts[order[0]] > ts[order[1]])
 		{
-            if (ray.direction.dz < 0.0)
-				oid.normalf.dz = -1.0;
-			else
-				oid.normalf.dz = 1.0;
+			a = order[0];
+			order[0] = order[1];
+			order[1] = a;
 		}
-
-		if ((fabs(oid.poif.x - voxel->min.x) < OTSIGMA) ||
-		(fabs(oid.poif.x - voxel->max.x) < OTSIGMA))
+		if (ts[order[1]] > ts[order[2]])
 		{
-			if (ray.direction.dx < 0.0)
-				oid.normalf.dx = -1.0;
-			else
-				oid.normalf.dx = 1.0;
+			a = order[1];
+			order[1] = order[2];
+			order[2] = a;
 		}
-
-		if ((fabs(oid.poif.y - voxel->min.y) < OTSIGMA) ||
-		(fabs(oid.poif.y - voxel->max.y) < OTSIGMA))
+		if (ts[order[0]] > ts[order[1]])
 		{
-			if (ray.direction.dy < 0.0)
-				oid.normalf.dy = -1.0;
-			else
-				oid.normalf.dy = 1.0;
+			a = order[0];
+			order[0] = order[1];
+			order[1] = a;
 		}
 
-		// Next, check if more than one ordinate is non-zero:
+		// Each crossing inside (tn, tf) moves the ray into the neighbouring
+		// child.  Count the (at most four) children first, so they can be
+		// pushed furthest first and the nearest one is popped first.
 
-		closest = fabs(oid.normalf.dx) + fabs(oid.normalf.dy) + fabs(oid.normalf.dz);
-		if (closest != 1.0)
+		n = 1;
+		t = tn;
+		for (b = 0; b < 3; b++)
 		{
-			printf("\nThe normal magnitude (%2.1f) is not 1.0 in iterate.\n", closest);
+			a = order[b];
+			if ((ts[a] > tn) && (ts[a] < tf) && (ts[a] > t))
+			{
+				n++;
+				t = ts[a];
+			}
+		}
+		if (sp + n > OTSTACKSIZE)
+		{
+			printf("The octree traversal stack overflowed in checktree.\n");
 			exit(1);
 		}
 
-		// Compute a point inside the voxel.
-
-		point = oid.poif + VtoP(oid.normalf * minlen2);
-
-		if (rootvoxel.inside(point))
-			return iterate(ray, findvoxel(&rootvoxel, point), idn);
-		else
-			return NULL;	// It left the world.
+		children = node->offset;
+		c = sp + n - 1;
+		t = tn;
+		for (b = 0; b < 3; b++)
+		{
+			a = order[b];
+			if ((ts[a] > tn) && (ts[a] < tf))
+			{
+				if (ts[a] > t)
+				{
+					pushchild(stack[c], children, side, size, min, t, ts[a]);
+					c--;
+					t = ts[a];
+				}
+				side[a] ^= 1;
+			}
+		}
+		pushchild(stack[c], children, side, size, min, t, tf);
+		sp += n;
 	}
+	return 0;	// The ray left the world without hitting anything.
 }
 
 
@@ -283,110 +390,10 @@ Boolean Voxel::icheck(Ray& aray, OctreeInterdata& id)
 }
 
 
-Voxel *findvoxel(Voxel *voxel, Point& point)
-{
-	// Return a pointer to the non-subdivided voxel containing point.
-	// This must be called with a subdivided voxel.
-
-	// First, determine which octant the point is in, and retrieve the
-	// pointer to the voxel in that octant.  Recurse if that voxel is
-	// subdivided, else return that voxel's pointer.
-
-	if ((point.x > voxel->min.x) && (point.x < (voxel->min.x + voxel->size / 2)))
-	{
-		// Then it's on the left side
-		if ((point.y > voxel->min.y) && (point.y < (voxel->min.y + voxel->size / 2)))
-		{
-			// Then it's on the bottom half
-			if ((point.z > voxel->min.z) && (point.z < (voxel->min.z + voxel->size / 2)))
-			{
-				// Then it's in the front half (quadrant 2)
-				if (voxel->childrenptr[2].subdivided == true)
-					return findvoxel(&voxel->childrenptr[2], point);
-				else
-					return &voxel->childrenptr[2];
-			}
-			else
-			{
-				// It's in the rear half.
-				if (voxel->childrenptr[6].subdivided == true)
-					return findvoxel(&voxel->childrenptr[6], point);
-				else
-					return &voxel->childrenptr[6];
-			}
-		}
-		else
-		{
-			// It's on the upper half
-			if ((point.z > voxel->min.z) && (point.z < (voxel->min.z + voxel->size / 2)))
-			{
-				// Then it's in the front half
-				if (voxel->childrenptr[0].subdivided == true)
-					return findvoxel(&voxel->childrenptr[0], point);
-				else
-					return &voxel->childrenptr[0];
-			}
-			else
-			{
-				// It's in the rear half.
-				if (voxel->childrenptr[4].subdivided == true)
-					return findvoxel(&voxel->childrenptr[4], point);
-				else
-					return &voxel->childrenptr[4];
-			}
-		}
-	}
-	else
-	{
-		// It's on the right side
-		if ((point.y > voxel->min.y) && (point.y < (voxel->min.y + voxel->size / 2)))
-		{
-			// Then it's on the bottom half
-			if ((point.z > voxel->min.z) && (point.z < (voxel->min.z + voxel->size / 2)))
-			{
-				// Then it's in the front half
-				if (voxel->childrenptr[3].subdivided == true)
-					return findvoxel(&voxel->childrenptr[3], point);
-				else
-					return &voxel->childrenptr[3];
-			}
-			else
-			{
-				// It's in the rear half.
-				if (voxel->childrenptr[7].subdivided == true)
-					return findvoxel(&voxel->childrenptr[7], point);
-				else
-					return &voxel->childrenptr[7];
-			}
-		}
-		else
-		{
-			// It's on the upper half
-			if ((point.z > voxel->min.z) && (point.z < (voxel->min.z + voxel->size / 2)))
-			{
-				// Then it's in the front half
-				if (voxel->childrenptr[1].subdivided == true)
-					return findvoxel(&voxel->childrenptr[1], point);
-				else
-					return &voxel->childrenptr[1];
-			}
-			else
-			{
-				// It's in the rear half.
-				if (voxel->childrenptr[5].subdivided == true)
-					return findvoxel(&voxel->childrenptr[5], point);
-				else
-					return &voxel->childrenptr[5];
-			}
-		}
-	}
-}
-
-
 void buildOctree(void)
 {
 	Point p, min, max;	// The extents of the world.
-	int x;
+	int x, *list;
 	FP size;
 
 	// First, determine the world extents.
@@ -428,152 +435,241 @@ void buildOctree(void)
 	rootvoxel.min = min;
 	rootvoxel.max.init(min.x + size, min.y + size, min.z + size);
 	rootvoxel.size = size;
-	minlen2 = size / 2;
 
 	printf("Finished determining the world extents.  The rootvoxel size is %f.\n\n", rootvoxel.size);
 
-	// Next, allocate space for children.
+	// Next, allocate space for children, and fill them in from the whole
+	// scene.  Subtrees are handed to other threads while there are any free.
 
 	rootvoxel.subdivided = true;
 	rootvoxel.numberOfObjects = 0;
 	rootvoxel.childrenptr = new Voxel[8];
-	numberOfVoxels = 9;	// The parent plus 8 children
 
-	// Next, recurse to fill in the children.
-	for (x = 0; x < 8; x++)
-	{
-		printf("Working on octant %d...\n", x);
+	list = new int[numberOfObjects];
+	for (x = 0; x < numberOfObjects; x++)
+		list[x] = x;
 
-		// First, fill in the appropriate fields in the voxel:
-		rootvoxel.childrenptr[x].size = size / 2;
-		setextents(x, size / 2, rootvoxel.childrenptr[x].min, rootvoxel.childrenptr[x].max, rootvoxel.min, rootvoxel.max);
+	startbuildthreads();
+	printf("Filling the octants, using up to %d threads...\n", freethreads + 1);
+	numberOfVoxels = 1 + fillchildren(&rootvoxel, list, numberOfObjects);
+	delete [] list;
 
-		// Finally, recurse to fill in the voxel with objects (or not):
-		voxelfill(&rootvoxel.childrenptr[x]);
-	}
-	printf("\n\n");
+	flattenOctree();
 }
 
 
-void voxelfill(Voxel *voxel)
+int voxelfill(Voxel *voxel, int *candidates, int numberOfCandidates)
 {
-	// Intersect this voxel with all objects.  If the number of intersected
-	// objects exceeds the threshold, subdivide this voxel and recurse.
-
-	int n;						// The number of objects intersecting this voxel.
-	Boolean intersection;		// True for intersections
-	Object **list;				// A pointer to an array of pointers.
-
-	list = new Object *[threshold+1];	// A temporary list of intersected objects
-
-	if (voxel->size / 2 < minlen2)
-		minlen2 = voxel->size / 2;	// Keep track of the smallest voxel size / 2.
-
-	// The following is code used in debugging voxelfill:
+	// Intersect this voxel with the candidate objects (its parent's).  If
+	// the number of intersected objects exceeds the threshold, subdivide
+	// this voxel and recurse.  Returns the number of voxels below this one.
 
-	if (voxel->size == 13127.85)
-		n = 0;
+	int n, voxels = 0;
+	int *list;					// Indices of the intersected objects
 
-	n = 0;
+	list = new int[numberOfCandidates];
 	voxel->numberOfObjects = 0;
-
-	do    // Loop through all objects in the scene
+	for (n = 0; n < numberOfCandidates; n++)
 	{
-		intersection = objptr[n]->voxelicheck(voxel->min, voxel->max);
-		if (intersection == true)
+		if (objptr[candidates[n]]->voxelicheck(voxel->min, voxel->max) == true)
 		{
-			list[voxel->numberOfObjects] = objptr[n];
+			list[voxel->numberOfObjects] = candidates[n];
 			voxel->numberOfObjects++;
 		}
-		n++;
-	}  while ((n < numberOfObjects) && (voxel->numberOfObjects <= threshold));
+	}
 
 	if (voxel->numberOfObjects > threshold)	// Then subdivide
 	{
 		voxel->subdivided = true;
-		voxel->numberOfObjects = 0;
 		voxel->childrenptr = new Voxel[8];
-		numberOfVoxels += 8;
+		voxels = fillchildren(voxel, list, voxel->numberOfObjects);
+		voxel->numberOfObjects = 0;
+		delete [] list;
+	}
+	else	// Keep the list (flattenOctree frees it).
+	{
+		voxel->subdivided = false;
+		voxel->list = list;
+	}
+	return voxels;
+}
 
-		// Next, recurse to fill in the children.
-		for (n = 0; n < 8; n++)
-		{
-			// First, fill in the appropriate fields in the voxel:
-			voxel->childrenptr[n].size = voxel->size / 2;
-			setextents(n, voxel->size / 2, voxel->childrenptr[n].min, voxel->childrenptr[n].max, voxel->min, voxel->max);
 
-			// Then, recurse to fill the voxel with objects (or not):
+static void fillthread(Voxel *voxel, int *candidates, int numberOfCandidates, int *voxels)
+{
+	*voxels = voxelfill(voxel, candidates, numberOfCandidates);
+	releasebuildthread();
+}
+
 
-			voxelfill(&voxel->childrenptr[n]);
-		}
+int fillchildren(Voxel *voxel, int *candidates, int numberOfCandidates)
+{
+	// Set the extents of voxel's eight children and fill them from the
+	// candidates, each on its own thread if one is free and there's enough
+	// work to be worth it.  Returns the number of voxels below voxel.
+
+	thread *threads[8];
+	int x, voxels[8], total = 8;
+
+	for (x = 0; x < 8; x++)
+	{
+		voxel->childrenptr[x].size = voxel->size / 2;
+		setextents(x, voxel->size / 2, voxel->childrenptr[x].min, voxel->childrenptr[x].max, voxel->min);
+
+		threads[x] = NULL;
+		if ((numberOfCandidates >= BUILDGRAIN) && (claimbuildthread() == true))
+			threads[x] = new thread(fillthread, &voxel->childrenptr[x], candidates, numberOfCandidates, &voxels[x]);
+		else
+			voxels[x] = voxelfill(&voxel->childrenptr[x], candidates, numberOfCandidates);
 	}
-	else	// Allocate a list of object pointers and copy over.
+	for (x = 0; x < 8; x++)
 	{
-		voxel->subdivided = false;
-		if (voxel->numberOfObjects > 0)
+		if (threads[x] != NULL)
 		{
-			voxel->list = new Object*[voxel->numberOfObjects];
-			for (n = 0; n < voxel->numberOfObjects; n++)
-				voxel->list[n] = list[n];
+			threads[x]->join();
+			delete threads[x];
 		}
+		total += voxels[x];
 	}
-	delete list;
+	return total;
 }
 
 
-void setextents(int x, FP size, Point& newmin, Point& newmax, Point& min, Point& max)
+void startbuildthreads(void)
 {
+	// Every core but the calling thread's may be used to build the tree.
+
+	freethreads = thread::hardware_concurrency() - 1;
+	if (freethreads < 0)
+		freethreads = 0;
+}
+
+
+Boolean claimbuildthread(void)	// True if another build thread may start
+{
+	int n = freethreads;
+
+	while (n > 0)
+	{
+		if (freethreads.compare_exchange_weak(n, n - 1))
+			return true;
+	}
+	return false;
+}
+
+
+void releasebuildthread(void)
+{
+	freethreads++;
+}
+
+
+static int countentries(Voxel *voxel)	// Object references below voxel
+{
+	int x, n = 0;
+
+	if (voxel->subdivided == false)
+		return voxel->numberOfObjects;
+	for (x = 0; x < 8; x++)
+		n += countentries(&voxel->childrenptr[x]);
+	return n;
+}
+
+static int nextnode, nextentry;	// The next free entries while flattening
+
+static void flattenvoxel(Voxel *voxel, int index)
+{
+	// Copy voxel into octnodes[index], with any children going in the next
+	// eight free entries, then free the voxel's children and list.
+
+	int x;
+
+	if (voxel->subdivided == true)
+	{
+		octnodes[index].offset = nextnode;
+		octnodes[index].numberOfObjects = -1;
+		nextnode += 8;
+		for (x = 0; x < 8; x++)
+			flattenvoxel(&voxel->childrenptr[x], octnodes[index].offset + x);
+		delete [] voxel->childrenptr;
+		voxel->childrenptr = NULL;
+	}
+	else
+	{
+		octnodes[index].offset = nextentry;
+		octnodes[index].numberOfObjects = voxel->numberOfObjects;
+		for (x = 0; x < voxel->numberOfObjects; x++)
+			octlist[nextentry++] = objhandle[voxel->list[x]];
+		sorthandles(&octlist[octnodes[index].offset], voxel->numberOfObjects);
+		delete [] voxel->list;
+	}
+}
+
+
+void flattenOctree(void)
+{
+	// Pack the voxel tree into octnodes, and all the leaves' object lists
+	// into octlist, so that checktree reads two contiguous arrays.
+
+	if (!(octnodes = new OctreeNode[numberOfVoxels]) ||
+	!(octlist = new unsigned int[countentries(&rootvoxel)]))
+	{
+		printf("\nInsufficient memory to flatten the octree.\n");
+		exit(1);
+	}
+	nextnode = 1;
+	nextentry = 0;
+	flattenvoxel(&rootvoxel, 0);
+}
+
+
+void setextents(int x, FP size, Point& newmin, Point& newmax, Point& min)
+{
+	// Every voxel's max is exactly its min plus its size, so that checktree
+	// can recompute it on the way down instead of storing it.
+
 	switch(x)
 	{
 		case 0:		// Left side, upper-front voxel.
 		{
 			newmin.init(min.x, min.y + size, min.z);
-			newmax.init(min.x + size, max.y, min.z + size);
 			break;
 		}
 		case 1:		// Right side, upper-front voxel.
 		{
 			newmin.init(min.x + size, min.y + size, min.z);
-			newmax.init(max.x, max.y, min.z + size);
 			break;
 		}
 		case 2:		// Left side, lower-front voxel.
 		{
 			newmin.init(min.x, min.y, min.z);
-			newmax.init(min.x + size, min.y + size, min.z + size);
 			break;
 		}
 		case 3:		// Right side, lower-front voxel.
 		{
 			newmin.init(min.x + size, min.y, min.z);
-			newmax.init(max.x, min.y + size, min.z + size);
 			break;
 		}
 		case 4:		// Left side, upper-rear voxel.
 		{
 			newmin.init(min.x, min.y + size, min.z + size);
-			newmax.init(min.x + size, max.y, max.z);
 			break;
 		}
 		case 5:		// Right side, upper-rear voxel.
 		{
 			newmin.init(min.x + size, min.y + size, min.z + size);
-			newmax.init(max.x, max.y, max.z);
 			break;
 		}
 		case 6:		// Left side, lower-rear voxel.
 		{
 			newmin.init(min.x, min.y, min.z + size);
-			newmax.init(min.x + size, min.y + size, max.z);
 			break;
 		}
 		case 7:		// Right side, lower-rear voxel.
 		{
 			newmin.init(min.x + size, min.y, min.z + size);
-			newmax.init(max.x, min.y + size, max.z);
 			break;
 		}
 	}	// end of switch...
+	newmax.init(newmin.x + size, newmin.y + size, newmin.z + size);
 }
-
-
@@ -4,12 +4,16 @@
 #define octree_h
 
 #define OTSIGMA 0.000000001
+#define OTSTACKSIZE 256		// Entries in the checktree traversal stack
+#define BUILDGRAIN 1024		// Fewer objects than this aren't worth a thread
+#define PACKETSIZE 4		// Primary rays traced together (see checkpacket)
 #include "platform.h"
 
-extern FP minlen2;
-extern Object *objptr[MAXOBJ];
+extern Object **objptr;
+extern unsigned int *objhandle;
 extern int numberOfObjects, numberOfVoxels, threshold;
 extern Boolean use_octree;
+extern int accel;
 
 class OctreeInterdata
 {
@@ -39,7 +43,7 @@ class Voxel
 	Boolean subdivided;		// True if this voxel has children
 	int numberOfObjects;		// The number of objects in this voxel
 	Voxel *childrenptr;		// Pointer to the children voxels
-	Object **list;			// Pointer to the list of objects in this voxel
+	int *list;				// Indices (in objptr) of the objects in this voxel
 
 	Boolean inside(Point& point)	// True if point's inside voxel.
 	{
@@ -51,13 +55,51 @@ class Voxel
 	Boolean icheck(Ray& aray, OctreeInterdata& id);
 };
 
+// Once built, the voxel tree is flattened into octnodes, with octnodes[0]
+// being rootvoxel.  A voxel's extents aren't stored; they're recomputed
+// from rootvoxel's on the way down, exactly as setextents made them.
+
+class OctreeNode	// A voxel of the flattened octree
+{
+	public:
+
+	int offset;				// Subdivided: its first child (of 8) in octnodes.
+							// Leaf: its first object in octlist.
+	int numberOfObjects;	// The number of objects in a leaf (-1 if subdivided)
+};
+
+class OctreeEntry	// An entry on the checktree traversal stack
+{
+	public:
+
+	int node;			// The voxel's index in octnodes
+	FP min[3];			// Its extents are min to min + size
+	FP size;
+	FP tn, tf;			// The part of the ray inside the voxel
+};
+
 extern Voxel rootvoxel;
+extern OctreeNode *octnodes;
+extern unsigned int *octlist;	// Handles (see pool.h)
+
+// Returns the child number (see setextents) for the given sides of the three
+// splitting planes, where 0 is the low side and 1 is the high side:
+
+inline int octant(int side[3])
+{
+	return side[0] + (1 - side[1]) * 2 + side[2] * 4;
+}
 
 Object *checktree(Ray& ray, Interdata& idn);
-Object *iterate(Ray& ray, Voxel *voxel, Interdata& id);
-Voxel *findvoxel(Voxel *voxel, Point& point);
+void checkpacket(Ray *rays, Interdata *idn, Object **hits, int count);
+unsigned int occluded(Ray& ray, FP maxt);
 void buildOctree(void);
-void voxelfill(Voxel *voxel);
-void setextents(int x, FP size, Point& newmin, Point& newmax, Point& min, Point& max);
+int voxelfill(Voxel *voxel, int *candidates, int numberOfCandidates);
+int fillchildren(Voxel *voxel, int *candidates, int numberOfCandidates);
+void flattenOctree(void);
+void setextents(int x, FP size, Point& newmin, Point& newmax, Point& min);
+void startbuildthreads(void);
+Boolean claimbuildthread(void);
+void releasebuildthread(void);
 
 #endif	// Of octree_h
@@ -0,0 +1,394 @@
+// parse.cc		Reading scene description files on all the cores
+
+#include <thread>			// (Must precede raytrace.h's min & max.)
+#include <locale>
+#include "platform.h"
+#include "raytrace.h"
+#include "vector.h"		// Vector-related objects and functions
+#include "miscobj.h"		// Miscellaneous objects
+#include "object.h"		// Object abstract-class definition
+#include "planar.h"		// Planar objects
+#include "quadric.h"		// Quadric objects
+#include "scene.h"		// readsettings, readobject, readrecord
+#include "parse.h"
+#include "pool.h"		// newhandle
+#include "material.h"		// finishmaterials, namesmaterial
+#include <string.h>
+#include <ctype.h>			// isspace, isdigit
+#include <errno.h>
+#include <fcntl.h>			// open
+#include <unistd.h>			// close
+#include <sys/mman.h>		// mmap
+#include <sys/stat.h>		// fstat
+
+// The scene description file is mapped, and read in two passes.  The
+// first reads the settings, the lights and the textures as readScene()
+// does, but only finds where each object's fields start, skipping them by
+// counting their numbers.  The second reads the objects, the file's run
+// of them split between the threads, each thread with a stream of its own
+// over the mapped file.  Every object goes to the place in objptr it had
+// in the file, so the objects come out as readScene() leaves them.
+//
+// The objects are read with their own >> operators, from streams whose
+// numbers are read by Fastnumbers rather than the locale's num_get.
+
+#define NUMBERLENGTH 255	// The longest number Fastnumbers reads
+#define PARSECHUNK 1024		// The fewest objects worth a thread
+
+extern int numberOfObjects, numberOfThreads;
+extern Object **objptr;
+extern int *objtype;			// Object type codes
+extern unsigned int *objhandle;	// Object handles
+
+static const double powersOfTen[] =	// Exact as doubles
+{
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+Membuf::Membuf(char *base, long size)
+{
+	setg(base, base, base + size);
+}
+
+streampos Membuf::seekoff(streamoff offset, ios_base::seekdir way, ios_base::openmode)
+{
+	char *position;
+
+	if (way == ios_base::beg)
+		position = eback() + offset;
+	else
+	if (way == ios_base::cur)
+		position = gptr() + offset;
+	else
+		position = egptr() + offset;
+	if ((position < eback()) || (position > egptr()))
+		return streampos(streamoff(-1));
+	setg(eback(), position, egptr());
+	return streampos(position - eback());
+}
+
+streampos Membuf::seekpos(streampos position, ios_base::openmode which)
+{
+	return seekoff(streamoff(position), ios_base::beg, which);
+}
+
+
+static int copynumber(istreambuf_iterator<char>& in, istreambuf_iterator<char>& end, char *text, Boolean real)
+{
+	// Copy the characters of a number (a real one if real is true) from in
+	// to text:  a sign, digits, and for a real one a point, more digits,
+	// and an exponent.  Returns its length, or -1 if it's too long.
+
+	int length = 0, part = 0;	// Part:  0 = whole, 1 = fraction, 2 = exponent
+	char c;
+
+	while (in != end)
+	{
+		c = *in;
+		if (isdigit(c) || (((c == '-') || (c == '+')) && ((length == 0) ||
+		((part == 2) && ((text[length - 1] == 'e') || (text[length - 1] == 'E'))))))
+			;
+		else
+		if (real && (c == '.') && (part == 0))
+			part = 1;
+		else
+		if (real && ((c == 'e') || (c == 'E')) && (part < 2))
+			part = 2;
+		else
+			break;
+		if (length == NUMBERLENGTH)
+			return -1;
+		text[length++] = c;
+		++in;
+	}
+	text[length] = '\0';
+	return length;
+}
+
+
+Fastnumbers::iter_type Fastnumbers::do_get(iter_type in, iter_type end, ios_base&, ios_base::iostate& error, double& value) const
+{
+	// Exact when the digits fit in a double and the power of ten is one
+	// (it's then one multiplication or division, rounded once);  otherwise
+	// it's left to strtod.  Either way the result is strtod's.
+
+	char text[NUMBERLENGTH + 1], *p, *stop;
+	unsigned long long mantissa = 0;
+	int length, digits = 0, significant = 0, exponent = 0, power = 0, powersign = 1;
+	Boolean negative, fast = true;
+
+	length = copynumber(in, end, text, true);
+	p = text;
+	negative = (*p == '-');
+	if ((*p == '-') || (*p == '+'))
+		p++;
+	for (; isdigit(*p); p++, digits++)
+	{
+		if (significant < 19)
+		{
+			mantissa = mantissa * 10 + (*p - '0');
+			if (mantissa != 0)
+				significant++;
+		}
+		else
+		{
+			fast = false;
+			exponent++;
+		}
+	}
+	if (*p == '.')
+		for (p++; isdigit(*p); p++, digits++)
+		{
+			if (significant < 19)
+			{
+				mantissa = mantissa * 10 + (*p - '0');
+				if (mantissa != 0)
+					significant++;
+				exponent--;
+			}
+			else
+				fast = false;
+		}
+	if ((digits > 0) && ((*p == 'e') || (*p == 'E')))
+	{
+		p++;
+		if ((*p == '-') || (*p == '+'))
+			powersign = (*p++ == '-') ? -1 : 1;
+		if (!isdigit(*p))
+			fast = false;
+		for (; isdigit(*p); p++)
+			if (power < 10000)
+				power = power * 10 + (*p - '0');
+		exponent += powersign * power;
+	}
+	if ((digits == 0) || (*p != '\0') || (length < 0))
+		fast = false;
+
+	if (fast && (mantissa <= (1ULL << 53)) && (exponent >= -22) && (exponent <= 22))
+	{
+		value = (FP)mantissa;
+		if (exponent >= 0)
+			value *= powersOfTen[exponent];
+		else
+			value /= powersOfTen[-exponent];
+		if (negative)
+			value = -value;
+	}
+	else
+	if ((length > 0) && (errno = 0, value = strtod(text, &stop), stop == &text[length]))
+	{
+		if ((errno == ERANGE) && ((value == HUGE_VAL) || (value == -HUGE_VAL)))
+			error |= ios_base::failbit;
+	}
+	else
+	{
+		value = 0.0;
+		error |= ios_base::failbit;
+	}
+	if (in == end)
+		error |= ios_base::eofbit;
+	return in;
+}
+
+
+Fastnumbers::iter_type Fastnumbers::do_get(iter_type in, iter_type end, ios_base&, ios_base::iostate& error, long& value) const
+{
+	char text[NUMBERLENGTH + 1], *stop;
+	int length;
+
+	length = copynumber(in, end, text, false);
+	if ((length > 0) && (length < 18) && isdigit(text[length - 1]))
+		value = atol(text);		// Too short to overflow
+	else
+	if ((length > 0) && (errno = 0, value = strtol(text, &stop, 10), stop == &text[length]))
+	{
+		if (errno == ERANGE)
+			error |= ios_base::failbit;
+	}
+	else
+	{
+		value = 0;
+		error |= ios_base::failbit;
+	}
+	if (in == end)
+		error |= ios_base::eofbit;
+	return in;
+}
+
+
+static char *skiptokens(char *p, char *end, int tokens)
+{
+	while (tokens-- > 0)
+	{
+		while ((p < end) && isspace(*p))
+			p++;
+		while ((p < end) && !isspace(*p))
+			p++;
+	}
+	return p;
+}
+
+static char *skipsurface(char *p, char *end)
+{
+	// An object's surface is eight numbers, or -m for material m.  (Its
+	// first is read as readmaterial reads it.)
+
+	char text[NUMBERLENGTH + 1];
+	int length;
+
+	while ((p < end) && isspace(*p))
+		p++;
+	for (length = 0; (length < NUMBERLENGTH) && (p + length < end) && !isspace(p[length]); length++)
+		text[length] = p[length];
+	text[length] = '\0';
+	return skiptokens(p, end, (namesmaterial(strtol(text, NULL, 10)) == true) ? 1 : 8);
+}
+
+static char *skipobject(char *p, char *end, int type)
+{
+	// Skip the fields of an object of the given type (its code has been
+	// read).  NULL if the type isn't an object's.
+
+	int vertexes;
+
+	switch (type)
+	{
+		case 1:			// Sphere:  surface, center, radius
+			return skiptokens(skipsurface(p, end), end, 3 + 1);
+		case 2:			// Box:  surface, min, max
+			return skiptokens(skipsurface(p, end), end, 3 + 3);
+		case 3:			// Orthoplane:  normal, surface, d, min, max
+			return skiptokens(skipsurface(skiptokens(p, end, 3), end), end, 1 + 3 + 3);
+		case 4:			// Cylinder:  surface, base, end, radius
+			return skiptokens(skipsurface(p, end), end, 3 + 3 + 1);
+		case 5:			// Quadric:  surface, a - j
+			return skiptokens(skipsurface(p, end), end, 10);
+		case 7:			// Polygon:  surface, vertexes, the vertexes
+		{
+			p = skipsurface(p, end);
+			while ((p < end) && isspace(*p))
+				p++;
+			for (vertexes = 0; (p < end) && isdigit(*p); p++)
+				vertexes = vertexes * 10 + (*p - '0');
+			return skiptokens(p, end, 3 * vertexes);
+		}
+		case 8:			// Plane:  surface, three corners
+			return skiptokens(skipsurface(p, end), end, 9);
+		case 9:			// Ring:  surface, normal, center, inner & outer radii
+			return skiptokens(skipsurface(p, end), end, 3 + 3 + 2);
+	}
+	return NULL;
+}
+
+
+static void parseobjects(char *base, long size, locale *numbers, long *starts, int first, int last)
+{
+	// Read objects first to last - 1, whose fields start at starts.
+
+	Membuf buffer(base, size);
+	istream f1(&buffer);
+	int x;
+
+	f1.imbue(*numbers);
+	for (x = first; x < last; x++)
+	{
+		f1.seekg(starts[x]);
+		objptr[x] = readobject(f1, objhandle[x]);
+	}
+}
+
+
+Boolean parseScene(char *filename)
+{
+	// Read the scene description in filename, as readScene() does.  False
+	// if it can't be mapped, to be read with readScene().
+
+	struct stat status;
+	char *base, *next;
+	long *starts = NULL, position;
+	int fd, temp, threads, x, startspace = 0;
+	thread **workers;
+
+	if ((fd = open(filename, O_RDONLY)) < 0)
+	{
+		printf("Cannot open %s for input.\n", filename);
+		exit(1);
+	}
+	if ((fstat(fd, &status) != 0) || (status.st_size == 0))
+	{
+		close(fd);
+		return false;
+	}
+	base = (char *)mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (base == (char *)MAP_FAILED)
+		return false;
+	locale numbers(locale::classic(), new Fastnumbers);
+	Membuf buffer(base, status.st_size);
+	istream f1(&buffer);
+
+	f1.imbue(numbers);
+	f1.setf(ios::skipws);	// Set I/O stream flags (skip whitespace on input)
+	readsettings(f1);
+
+	// Find the objects, and read everything else.
+
+	do
+	{
+		f1 >> temp;			// Read in the object type
+		if (!f1)
+			break;
+		position = (long)f1.tellg();
+		if ((next = skipobject(&base[position], &base[status.st_size], temp)) != NULL)
+		{
+			makeroom(numberOfObjects + 1, 0, 0, 0);
+			if (numberOfObjects == startspace)
+			{
+				startspace = (startspace == 0) ? 1024 : startspace * 2;
+				if (!(starts = (long *)realloc(starts, startspace * sizeof(long))))
+				{
+					printf("\nInsufficient memory to read the scene.\n");
+					exit(1);
+				}
+			}
+			starts[numberOfObjects] = position;
+			objtype[numberOfObjects] = temp;
+			objhandle[numberOfObjects] = newhandle(temp);
+			numberOfObjects++;
+			f1.seekg(next - base);
+		}
+		else
+			readrecord(f1, temp);
+	}  while (temp != -1);
+
+	// Then read the objects.
+
+	threads = numberOfObjects / PARSECHUNK;
+	if (threads > numberOfThreads)
+		threads = numberOfThreads;
+	if (threads < 1)
+		threads = 1;
+	if (!(workers = new thread *[threads]))
+	{
+		printf("\nInsufficient memory to start the reading threads.\n");
+		exit(1);
+	}
+	for (x = 1; x < threads; x++)
+		workers[x] = new thread(parseobjects, base, (long)status.st_size, &numbers, starts,
+		(int)((long)numberOfObjects * x / threads), (int)((long)numberOfObjects * (x + 1) / threads));
+	parseobjects(base, status.st_size, &numbers, starts, 0, numberOfObjects / threads);
+	for (x = 1; x < threads; x++)
+	{
+		workers[x]->join();
+		delete workers[x];
+	}
+	delete [] workers;
+	free(starts);
+	munmap(base, status.st_size);
+
+	finishmaterials();
+	checktextures();
+	return true;
+}
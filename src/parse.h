@@ -0,0 +1,28 @@
+// parse.h		Reading scene description files on all the cores
+
+#ifndef parse_h
+#define parse_h
+
+class Membuf : public streambuf		// A stream buffer over a mapped file
+{
+	public:
+
+	Membuf(char *base, long size);
+
+	protected:
+
+	streampos seekoff(streamoff offset, ios_base::seekdir way, ios_base::openmode which);
+	streampos seekpos(streampos position, ios_base::openmode which);
+};
+
+class Fastnumbers : public num_get<char>	// Reads numbers without the locale
+{
+	protected:
+
+	iter_type do_get(iter_type in, iter_type end, ios_base& s, ios_base::iostate& error, long& value) const;
+	iter_type do_get(iter_type in, iter_type end, ios_base& s, ios_base::iostate& error, double& value) const;
+};
+
+Boolean parseScene(char *filename);
+
+#endif	// Of parse_h
@@ -6,8 +6,10 @@
 #include "textures.h"
 #include "object.h"
 #include "planar.h"
+#include "material.h"
 
-extern Texture *textptr[64];
+extern Texture **textptr;
+extern Surface *materials;
 extern int x, y;
 extern Boolean used_by_scenebuilder;
 
@@ -16,10 +18,10 @@ Orthoplane::Orthoplane(void)
 {
 }
 
-void Orthoplane::init(Vector inormal, Surface isurface, FP id, Point imin, Point imax)
+void Orthoplane::init(Vector inormal, int imaterial, FP id, Point imin, Point imax)
 {
 	normal = inormal;
-	surface = isurface;
+	material = imaterial;
 	d = id;
 	min = imin;
 	max = imax;
@@ -80,7 +82,8 @@ void Orthoplane::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 	ray, the reflected ray, and the di factor.
 */
 
-	Surface tsurface = surface;
+	Surface& surface = materials[material];
+	Color color = surface.color;
 	FP xx, yy;
 
 	if (surface.texture != 0)
@@ -105,9 +108,9 @@ void Orthoplane::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 			xx = (id.poi.z - min.z) / (max.z - min.z);
 			yy = (id.poi.y - min.y) / (max.y - min.y);
 		}
-		tsurface.color.init(textptr[tsurface.texture]->getcolor(xx, yy));
+		color.init(textptr[surface.texture]->getcolor(xx, yy));
 	}
-	nodeptr->init(id.poi, normal, tsurface, Ray(id.poi, aray.direction),
+	nodeptr->init(id.poi, normal, material, color, Ray(id.poi, aray.direction),
 	Ray(id.poi, reflect(aray.direction, normal)), 0, 0, false, false, false);
 }
 
@@ -128,13 +131,15 @@ Boolean Orthoplane::voxelicheck(Point& vmin, Point& vmax)
 
 istream& operator >> (istream& s, Orthoplane& p)
 {
-	s >> p.normal >> p.surface >> p.d >> p.min >> p.max;
+	s >> p.normal;
+	readmaterial(s, p.material) >> p.d >> p.min >> p.max;
 	return s;
 }
 
 ostream& operator << (ostream& s, Orthoplane& p)
 {
-	s << p.normal << p.surface << p.d << "\n" << p.min << p.max;
+	s << p.normal;
+	writematerial(s, p.material) << p.d << "\n" << p.min << p.max;
 	return s;
 }
 
@@ -145,11 +150,11 @@ Plane::Plane(void)
 }
 
 
-void Plane::init(Surface isurface, Point ip0, Point ip1, Point ip2)
+void Plane::init(int imaterial, Point ip0, Point ip1, Point ip2)
 {
 	Vector x, y;
 
-	surface = isurface;
+	material = imaterial;
 	p[0] = ip0;
 	p[1] = ip1;
 	p[2] = ip2;
@@ -276,7 +281,8 @@ void Plane::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 	ray, the reflected ray, and the di factor.
 */
 
-	Surface tsurface = surface;
+	Surface& surface = materials[material];
+	Color color = surface.color;
 	FP uu, vv;
 
 	if (surface.texture != 0)
@@ -285,10 +291,10 @@ void Plane::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 
 		uu = ((id.poi * nc) - du0) / (du1 - (id.poi * na));
 		vv = ((id.poi * nb) - dv0) / (dv1 - (id.poi * na));
-		tsurface.color.init(textptr[surface.texture]->getcolor(uu, vv));
+		color.init(textptr[surface.texture]->getcolor(uu, vv));
 	}
 
-	nodeptr->init(id.poi, normal, tsurface, Ray(id.poi, aray.direction),
+	nodeptr->init(id.poi, normal, material, color, Ray(id.poi, aray.direction),
 	Ray(id.poi, reflect(aray.direction, normal)), 0, 0, false, false, false);
 }
 
@@ -305,7 +311,7 @@ istream& operator >> (istream& s, Plane& p)
 	FP leglength;
 	int x;
 
-	s >> p.surface >> p.p[0] >> p.p[1] >> p.p[2];
+	readmaterial(s, p.material) >> p.p[0] >> p.p[1] >> p.p[2];
 
 	// Set up for inverse mapping...
 
@@ -384,7 +390,7 @@ istream& operator >> (istream& s, Plane& p)
 
 ostream& operator << (ostream& s, Plane& p)
 {
-	s << p.surface << p.p[0] << p.p[1] << p.p[2];
+	writematerial(s, p.material) << p.p[0] << p.p[1] << p.p[2];
 	return s;
 }
 
@@ -393,9 +399,9 @@ Box::Box(void)
 {
 }
 
-void Box::init(Surface isurface, Point imin, Point imax)
+void Box::init(int imaterial, Point imin, Point imax)
 {
-	surface = isurface;
+	material = imaterial;
 	min = imin;
 	max = imax;
 }
@@ -475,6 +481,7 @@ void Box::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 	Ray transmitted;
 	Vector incident = aray.direction;
 	FP ci;
+	Surface& surface = materials[material];
 
 	if (fabs(id.poi.z - min.z) < 0.0000001)
 		id.normal.init(0,0,-1.0);
@@ -509,7 +516,7 @@ void Box::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 	{
 	}
 
-	nodeptr->init(id.poi, id.normal, surface, transmitted,
+	nodeptr->init(id.poi, id.normal, material, surface.color, transmitted,
 	Ray(id.poi, reflect(incident, id.normal)), 0, 0, false, false, false);
 }
 
@@ -536,13 +543,13 @@ Boolean Box::voxelicheck(Point& vmin, Point& vmax)
 
 istream& operator >> (istream& s, Box& p)
 {
-	s >> p.surface >> p.min >> p.max;
+	readmaterial(s, p.material) >> p.min >> p.max;
 	return s;
 }
 
 ostream& operator << (ostream& s, Box& p)
 {
-	s << p.surface << p.min << p.max;
+	writematerial(s, p.material) << p.min << p.max;
 	return s;
 }
 
@@ -551,12 +558,14 @@ ostream& operator << (ostream& s, Box& p)
 Polygon::Polygon(void)
 {
 	vertexes = 0;
+	u = v = NULL;
+	vertex = NULL;
 }
 
 
-void Polygon::init(Surface isurface, int ivertexes)
+void Polygon::init(int imaterial, int ivertexes)
 {
-	surface = isurface;
+	material = imaterial;
 	vertexes = ivertexes;
 }
 
@@ -709,7 +718,7 @@ Boolean Polygon::icheck(Ray& aray, Interdata& id)
 
 void Polygon::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 {
-	nodeptr->init(id.poi, normal, surface, Ray(id.poi, aray.direction),
+	nodeptr->init(id.poi, normal, material, materials[material].color, Ray(id.poi, aray.direction),
 	Ray(id.poi, reflect(aray.direction, normal)), 0, 0, false, false, false);
 }
 
@@ -930,9 +939,9 @@ istream& operator >> (istream& s, Polygon& p)
 	int x;
 	Vector a, b;
 
-	// Load in the surface and the number of vertexes
+	// Load in the material and the number of vertexes
 
-	s >> p.surface >> p.vertexes;
+	readmaterial(s, p.material) >> p.vertexes;
 
 	// Next, load in the polygon:
 
@@ -1030,7 +1039,7 @@ ostream& operator << (ostream& s, Polygon& p)
 	int x;
 	Point point;
 
-	s << p.surface << p.vertexes << "\n";
+	writematerial(s, p.material) << p.vertexes << "\n";
 	if (used_by_scenebuilder == true)
 	{
 		for (x = 0; x < p.vertexes; x++)
@@ -1051,12 +1060,12 @@ Ring::Ring(void)
 }
 
 
-void Ring::init(Surface isurface, Vector inormal, Point icenter, FP iinnerr, FP iouterr)
+void Ring::init(int imaterial, Vector inormal, Point icenter, FP iinnerr, FP iouterr)
 {
 	Vector x;
 
 	normal = inormal;
-	surface = isurface;
+	material = imaterial;
 	center = icenter;
 	innerr = iinnerr;
 	outerr = iouterr;
@@ -1124,7 +1133,8 @@ void Ring::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 	ray, the reflected ray, and the di factor.
 */
 
-	Surface tsurface = surface;
+	Surface& surface = materials[material];
+//	Color color = surface.color;
 //	FP uu, vv;
 
 /*	// No inverse mapping yet.
@@ -1134,11 +1144,11 @@ void Ring::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 
 		uu = ((id.poi * nc) - du0) / (du1 - (id.poi * na));
 		vv = ((id.poi * nb) - dv0) / (dv1 - (id.poi * na));
-		tsurface.color.init(textptr[surface.texture]->getcolor(uu, vv));
+		color.init(textptr[surface.texture]->getcolor(uu, vv));
 	}
 */
 
-	nodeptr->init(id.poi, normal, tsurface, Ray(id.poi, aray.direction),
+	nodeptr->init(id.poi, normal, material, surface.color, Ray(id.poi, aray.direction),
 	Ray(id.poi, reflect(aray.direction, normal)), 0, 0, false, false, false);
 }
 
@@ -1151,13 +1161,13 @@ Boolean Ring::voxelicheck(Point& vmin, Point& vmax)
 
 istream& operator >> (istream& s, Ring& p)
 {
-	s >> p.surface >> p.normal >> p.center >> p.innerr >> p.outerr;
+	readmaterial(s, p.material) >> p.normal >> p.center >> p.innerr >> p.outerr;
 	return s;
 }
 
 ostream& operator << (ostream& s, Ring& p)
 {
-	s << p.surface << p.normal << p.center << p.innerr << "\n" << p.outerr << "\n";
+	writematerial(s, p.material) << p.normal << p.center << p.innerr << "\n" << p.outerr << "\n";
 	return s;
 }
 
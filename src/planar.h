@@ -12,7 +12,7 @@ class Orthoplane : public Object
 	Point min, max;	// The minimum and maximum extents of the plane.
 
 	Orthoplane(void);
-	void init(Vector inormal, Surface isurface, FP id, Point imin, Point imax);
+	void init(Vector inormal, int imaterial, FP id, Point imin, Point imax);
 	Boolean icheck(Ray& aray, Interdata& id);
 	void intersect(Ray& aray, Node *nodeptr, Interdata& id);
 	Point getMin(void)
@@ -45,7 +45,7 @@ class Plane : public Object
 	FP u[4], v[4];
 
 	Plane(void);
-	void init(Surface isurface, Point ip0, Point ip1, Point ip2);
+	void init(int imaterial, Point ip0, Point ip1, Point ip2);
 	Boolean icheck(Ray& aray, Interdata& id);
 	void intersect(Ray& aray, Node *nodeptr, Interdata& id);
 	Point getMin(void)
@@ -119,7 +119,7 @@ class Box : public Object
 	Point min, max;
 
 	Box(void);
-	void init(Surface isurface, Point imin, Point imax);
+	void init(int imaterial, Point imin, Point imax);
 	Boolean icheck(Ray& aray, Interdata& id);
 	void intersect(Ray& aray, Node *nodeptr, Interdata& id);
 	Point getMin(void)
@@ -152,7 +152,7 @@ class Polygon : public Object
 	Point min, max;	// The extents of the polygon, set during load.
 
 	Polygon(void);
-	void init(Surface isurface, int ivertexes);
+	void init(int imaterial, int ivertexes);
 	Boolean icheck(Ray& aray, Interdata& id);
 	void intersect(Ray& aray, Node *nodeptr, Interdata& id);
 	Point getMin(void)
@@ -181,7 +181,7 @@ class Ring : public Object
 	FP innerr, outerr, d;	// The inner and outer radiuses, and the distance
 
 	Ring(void);
-	void init(Surface isurface, Vector inormal, Point icenter, FP iinnerr, FP iouterr);
+	void init(int imaterial, Vector inormal, Point icenter, FP iinnerr, FP iouterr);
 	Boolean icheck(Ray& aray, Interdata& id);
 	void intersect(Ray& aray, Node *nodeptr, Interdata& id);
 	Point getMin(void)
@@ -1 +1 @@
-#define MAXOBJ 262144
+// platform.h	Settings that differ from one platform to another
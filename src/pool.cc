@@ -0,0 +1,230 @@
+// pool.cc		The objects of each type stored together, in memory that's
+//				freed all at once when the scene is
+
+#include "platform.h"
+#include "raytrace.h"
+#include "vector.h"		// Vector-related objects and functions
+#include "miscobj.h"		// Miscellaneous objects
+#include "lights.h"		// Light objects
+#include "textures.h"	// Texture objects
+#include "object.h"		// Object abstract-class definition
+#include "planar.h"		// Planar objects
+#include "quadric.h"		// Quadric objects
+#include "scene.h"		// freeScene
+#include "sdb.h"		// unmapScene
+#include "accelcache.h"		// freeaccel
+#include "spheres.h"		// sphereblocks, sphereruns
+#include "pool.h"
+
+// Each type of object has a pool, which gets its blocks from the arena.
+// An object is known to the octree and the BVH by its handle:  its type
+// and its index in its pool, in one int.  (Its place in objptr is still
+// its place in the scene description.)  The objects are constructed in
+// their pools, and never deleted one at a time;  freeScene() hands all of
+// the arena's blocks back at once.  Tracing, an object is tested with
+// icheckhandle(), which calls its type's icheck() directly.
+
+extern int numberOfObjects, numberOfLights, numberOfTextures, numberOfMaterials;
+extern Object **objptr;
+extern Light **lightptr;
+extern Texture **textptr;
+extern Surface *materials;
+extern int *objtype, *textype, *lightype;
+extern unsigned int *objhandle;
+extern int objectspace, lightspace, texturespace, materialspace;
+extern Boolean scenemapped;
+
+Arena arena;
+Pool pools[NUMBEROFTYPES] = {Pool(0), Pool(sizeof(Sphere)), Pool(sizeof(Box)),
+Pool(sizeof(Orthoplane)), Pool(sizeof(Cylinder)), Pool(sizeof(Quadric)), Pool(0),
+Pool(sizeof(Polygon)), Pool(sizeof(Plane)), Pool(sizeof(Ring)), Pool(0), Pool(0),
+Pool(0), Pool(0), Pool(0), Pool(0)};
+
+
+void *Arena::allocate(long bytes)
+{
+	char **newblocks;
+	int x;
+
+	if (numberOfBlocks == blockspace)
+	{
+		if (!(newblocks = new char *[(blockspace == 0) ? 64 : blockspace * 2]))
+			return NULL;
+		for (x = 0; x < numberOfBlocks; x++)
+			newblocks[x] = blocks[x];
+		delete [] blocks;
+		blocks = newblocks;
+		blockspace = (blockspace == 0) ? 64 : blockspace * 2;
+	}
+	if (!(blocks[numberOfBlocks] = new char[bytes]))
+		return NULL;
+	return blocks[numberOfBlocks++];
+}
+
+void Arena::release(void)
+{
+	int x;
+
+	for (x = 0; x < numberOfBlocks; x++)
+		delete [] blocks[x];
+	delete [] blocks;
+	blocks = NULL;
+	numberOfBlocks = blockspace = 0;
+}
+
+
+int Pool::add(void)
+{
+	// Make room for one more object, and return its index (-1 if there's
+	// no memory for it).
+
+	char **newblocks;
+	int x;
+
+	if ((count & (POOLBLOCK - 1)) == 0)
+	{
+		if ((count >> POOLSHIFT) == blockspace)
+		{
+			if (!(newblocks = new char *[(blockspace == 0) ? 16 : blockspace * 2]))
+				return -1;
+			for (x = 0; x < blockspace; x++)
+				newblocks[x] = blocks[x];
+			delete [] blocks;
+			blocks = newblocks;
+			blockspace = (blockspace == 0) ? 16 : blockspace * 2;
+		}
+		if (!(blocks[count >> POOLSHIFT] = (char *)arena.allocate((long)POOLBLOCK * size)))
+			return -1;
+	}
+	return count++;
+}
+
+void Pool::release(void)
+{
+	// (The arena frees the blocks themselves.)
+
+	delete [] blocks;
+	blocks = NULL;
+	count = blockspace = 0;
+}
+
+
+unsigned int newhandle(int type)
+{
+	// Make room for another object of the given type, and return its
+	// handle (0 if the type isn't an object's).
+
+	int index;
+
+	if ((type < 0) || (type >= NUMBEROFTYPES) || (pools[type].size == 0))
+		return 0;
+	if ((index = pools[type].add()) < 0)
+	{
+		printf("\nInsufficient memory to allocate space for the objects of type %d.\n", type);
+		exit(1);
+	}
+	return ((unsigned int)type << HANDLESHIFT) | index;
+}
+
+
+Object *newobject(unsigned int handle)
+{
+	// Construct the object that handle has room for.  (Different threads
+	// may construct different objects at once.)
+
+	void *object = handleobject(handle);
+
+	switch (handle >> HANDLESHIFT)
+	{
+		case 1:
+			return new (object) Sphere();
+		case 2:
+			return new (object) Box();
+		case 3:
+			return new (object) Orthoplane();
+		case 4:
+			return new (object) Cylinder();
+		case 5:
+			return new (object) Quadric();
+		case 7:
+			return new (object) Polygon();
+		case 8:
+			return new (object) Plane();
+		case 9:
+			return new (object) Ring();
+	}
+	return NULL;
+}
+
+
+static int comparehandles(const void *a, const void *b)
+{
+	unsigned int x = *(unsigned int *)a, y = *(unsigned int *)b;
+
+	return (x < y) ? -1 : ((x > y) ? 1 : 0);
+}
+
+void sorthandles(unsigned int *list, int count)
+{
+	// Sort a leaf's list of handles:  by type, then by place in the pool.
+
+	if (count > 1)
+		qsort(list, count, sizeof(unsigned int), comparehandles);
+}
+
+
+void freeScene(void)
+{
+	// Free everything the scene was read into:  its objects, with their
+	// pools, at once, the polygons' vertex arrays (unless they're in a
+	// mapped, compiled scene), the lights and textures, and the materials;
+	// then the octree or BVH, with its sphere blocks, and any mapped files.
+
+	Polygon *polygon;
+	int x;
+
+	for (x = 0; (scenemapped == false) && (x < pools[7].count); x++)
+	{
+		polygon = (Polygon *)pools[7].at(x);
+		delete [] polygon->vertex;
+		delete [] polygon->u;
+		delete [] polygon->v;
+	}
+	for (x = 0; x < NUMBEROFTYPES; x++)
+	{
+		pools[x].release();
+	}
+	arena.release();
+
+	for (x = 0; x < numberOfLights; x++)
+		delete lightptr[x];
+	for (x = 1; x < numberOfTextures; x++)
+		delete textptr[x];
+
+	free(objptr);
+	free(objtype);
+	free(objhandle);
+	free(lightptr);
+	free(lightype);
+	free(textptr);
+	free(textype);
+	free(materials);
+	objptr = NULL;
+	objtype = NULL;
+	objhandle = NULL;
+	lightptr = NULL;
+	lightype = NULL;
+	textptr = NULL;
+	textype = NULL;
+	materials = NULL;
+	objectspace = lightspace = texturespace = materialspace = 0;
+	numberOfObjects = numberOfLights = numberOfMaterials = 0;
+	numberOfTextures = 1;	// 0 = no texture
+
+	freeaccel();
+	free(sphereblocks);		// (From posix_memalign.)
+	delete [] sphereruns;
+	sphereblocks = NULL;
+	sphereruns = NULL;
+	unmapScene();
+}
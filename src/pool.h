@@ -0,0 +1,98 @@
+// pool.h		The objects of each type stored together, in memory that's
+//				freed all at once when the scene is
+
+#ifndef pool_h
+#define pool_h
+
+#define POOLSHIFT 12				// A pool's blocks hold 4096 objects
+#define POOLBLOCK (1 << POOLSHIFT)
+#define HANDLESHIFT 28				// A handle is an object's type code, then
+#define HANDLEINDEX ((1 << HANDLESHIFT) - 1)	// its index in that type's pool
+#define NUMBEROFTYPES 16			// Object type codes are below this
+
+class Arena		// The memory for a scene's objects
+{
+	public:
+
+	char **blocks;			// Everything allocated, to be freed together
+	int numberOfBlocks, blockspace;
+
+	Arena(void)
+	{
+		blocks = NULL;
+		numberOfBlocks = blockspace = 0;
+	}
+	void *allocate(long bytes);
+	void release(void);
+};
+
+extern Arena arena;
+
+class Pool		// The objects of one type
+{
+	public:
+
+	char **blocks;		// Each holds POOLBLOCK objects;  they never move
+	int size;			// The size of an object
+	int count;			// The objects in the pool
+	int blockspace;		// The length of blocks
+
+	Pool(int isize)
+	{
+		blocks = NULL;
+		size = isize;
+		count = blockspace = 0;
+	}
+	Object *at(int index)	// (Object is each type's only base, so an
+	{						// object starts where its Object part does.)
+		return (Object *)&blocks[index >> POOLSHIFT][(index & (POOLBLOCK - 1)) * size];
+	}
+	int add(void);
+	void release(void);
+};
+
+extern Pool pools[NUMBEROFTYPES];	// By type code (empty if not an object's)
+
+inline Object *handleobject(unsigned int handle)
+{
+	// The object a handle refers to.
+
+	return pools[handle >> HANDLESHIFT].at(handle & HANDLEINDEX);
+}
+
+inline Boolean icheckhandle(unsigned int handle, Ray& aray, Interdata& id)
+{
+	// The object's icheck(), called for its type rather than through its
+	// vtable, so that it can be inlined (the sphere's is).  The leaves'
+	// lists are sorted (see sorthandles()), so a leaf's objects come
+	// grouped by type, and the switch goes the same way for each group.
+
+	Object *object = handleobject(handle);
+
+	switch (handle >> HANDLESHIFT)
+	{
+		case 1:
+			return ((Sphere *)object)->Sphere::icheck(aray, id);
+		case 2:
+			return ((Box *)object)->Box::icheck(aray, id);
+		case 3:
+			return ((Orthoplane *)object)->Orthoplane::icheck(aray, id);
+		case 4:
+			return ((Cylinder *)object)->Cylinder::icheck(aray, id);
+		case 5:
+			return ((Quadric *)object)->Quadric::icheck(aray, id);
+		case 7:
+			return ((Polygon *)object)->Polygon::icheck(aray, id);
+		case 8:
+			return ((Plane *)object)->Plane::icheck(aray, id);
+		case 9:
+			return ((Ring *)object)->Ring::icheck(aray, id);
+	}
+	return false;
+}
+
+unsigned int newhandle(int type);
+Object *newobject(unsigned int handle);
+void sorthandles(unsigned int *list, int count);
+
+#endif	// Of pool_h
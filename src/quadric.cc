@@ -6,8 +6,10 @@
 #include "textures.h"
 #include "object.h"
 #include "quadric.h"
+#include "material.h"
 
-extern Texture *textptr[64];
+extern Texture **textptr;
+extern Surface *materials;
 extern int x, y;
 extern Boolean used_by_scenebuilder;
 
@@ -16,50 +18,13 @@ Sphere::Sphere(void)
 {
 }
 
-void Sphere::init(Surface isurface, Point icenter, FP ira)
+void Sphere::init(int imaterial, Point icenter, FP ira)
 {
-	surface = isurface;
+	material = imaterial;
 	center = icenter;
 	ra = ira;
 }
 
-Boolean Sphere::icheck(Ray& aray, Interdata& id)
-{
-	// Algorithm from Eric Haines in Ray Tracing. (the geometric method)
-
-	FP l2, d, tca;
-	Boolean outside = true;
-	Vector oc = center - aray.origin;
-
-	// tca is the distance from origin to closest approach to the sphere center
-	tca = oc * aray.direction;
-	l2 = oc * oc;			//  l2 is length^2 of the origin to the center vector.
-	if (l2 <= ras)
-		outside = false;	//  The ray origin is inside the sphere.
-	if ((tca < sigma) && (outside == true))
-		return false;		//  The ray won't intersect the sphere.
-	d = ras + sqr(tca) - l2;
-	if (d < sigma)
-		return false;
-	if (outside == true)
-	{
-
-		id.t = tca - sqrt(d);
-		if (fabs(id.t) < sigma)
-			id.t = tca + sqrt(d);
-	}
-	else
-	{
-		id.t = tca + sqrt(d);
-		if (fabs(id.t) < sigma)
-			return false;
-	}
-	id.poi = aray.getPoi(id.t);
-	id.normal = id.poi - center;
-	id.normal.unitize();
-	return true;
-}
-
 // Note, on the intersect function, a reflected ray will be generated only if
 // kspec is non-zero AND entering is true. But the trace function will trace
 // a reflected ray if kspec is non-zero, regardless of entering.  FIX THIS!!!
@@ -74,8 +39,8 @@ void Sphere::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 	Vector incident, a, s;
 	FP ci, n, q;
 	Boolean entering = nodeptr->entering;
-	Surface tsurface;
-	tsurface = surface;
+	Surface& surface = materials[material];
+	Color color = surface.color;
 
 	incident = aray.direction;
 
@@ -150,9 +115,9 @@ void Sphere::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 			}
 		}	// Note: u & v vary from 0 - 1
 
-		tsurface.color.init(textptr[surface.texture]->getcolor(u, v));
+		color.init(textptr[surface.texture]->getcolor(u, v));
 	}
-	nodeptr->init(id.poi, id.normal, tsurface, transmitted, reflected, 0, 0, false, false, entering);
+	nodeptr->init(id.poi, id.normal, material, color, transmitted, reflected, 0, 0, false, false, entering);
 }
 
 
@@ -196,14 +161,14 @@ Boolean Sphere::voxelicheck(Point& vmin, Point& vmax)
 
 istream& operator >> (istream& s, Sphere& p)
 {
-	s >> p.surface >> p.center >> p.ra;
+	readmaterial(s, p.material) >> p.center >> p.ra;
 	p.ras = sqr(p.ra);		// Compute the radius squared.
 	return s;
 }
 
 ostream& operator << (ostream& s, Sphere& p)
 {
-	s << p.surface << p.center << p.ra << "\n";
+	writematerial(s, p.material) << p.center << p.ra << "\n";
 	return s;
 }
 
@@ -244,6 +209,8 @@ void Cylinder::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 	Vector incident, a, s;
 	FP ci, n, q;
 	Boolean entering = nodeptr->entering;
+	Surface& surface = materials[material];
+	Color color = surface.color;
 
 	incident = aray.direction;
 
@@ -293,9 +260,9 @@ void Cylinder::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 		{
 			u = 1 - u;
 		}
-		surface.color.init(textptr[surface.texture]->getcolor(u, v));
+		color.init(textptr[surface.texture]->getcolor(u, v));
 	}
-	nodeptr->init(id.poi, id.normal, surface, transmitted, reflected, 0, 0, false, false, entering);
+	nodeptr->init(id.poi, id.normal, material, color, transmitted, reflected, 0, 0, false, false, entering);
 }
 
 
@@ -307,7 +274,7 @@ Boolean Cylinder::voxelicheck(Point& vmin, Point& vmax)
 
 istream& operator >> (istream& s, Cylinder& c)
 {
-	s >> c.surface >> c.base >> c.end >> c.ra;
+	readmaterial(s, c.material) >> c.base >> c.end >> c.ra;
 	c.ras = sqr(c.ra);		// Compute the radius squared.
 	c.h = c.base / c.end;	// Compute the cylinder's height.
 	return s;
@@ -315,7 +282,7 @@ istream& operator >> (istream& s, Cylinder& c)
 
 ostream& operator << (ostream& s, Cylinder& c)
 {
-	s << c.surface << c.base << c.end << c.ra << "\n";
+	writematerial(s, c.material) << c.base << c.end << c.ra << "\n";
 	return s;
 }
 
@@ -334,9 +301,9 @@ Quadric::Quadric(void)
 	j = 0;
 }
 
-void Quadric::init(Surface isurface, FP ia, FP ib, FP ic, FP id, FP ie, FP iif, FP ig, FP ih, FP ii, FP ij)
+void Quadric::init(int imaterial, FP ia, FP ib, FP ic, FP id, FP ie, FP iif, FP ig, FP ih, FP ii, FP ij)
 {
-	surface = isurface;
+	material = imaterial;
 	a = ia;
 	b = ib;
 	c = ic;
@@ -412,6 +379,7 @@ void Quadric::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 	Vector incident, x, s;
 	FP ci, n, q;
 	Boolean entering = nodeptr->entering;
+	Surface& surface = materials[material];
 
 	if ((surface.kspec > 0.0) && (entering == true))	// Compute the reflected ray
 	{
@@ -450,7 +418,7 @@ void Quadric::intersect(Ray& aray, Node *nodeptr, Interdata& id)
 
 //	if (surface.kdiff > 0.0){}	// I don't know how to inverse map a quadric!
 
-	nodeptr->init(id.poi, id.normal, surface, transmitted, reflected, 0, 0, false, false, entering);
+	nodeptr->init(id.poi, id.normal, material, surface.color, transmitted, reflected, 0, 0, false, false, entering);
 }
 
 
@@ -462,14 +430,14 @@ Boolean Quadric::voxelicheck(Point& vmin, Point& vmax)
 
 istream& operator >> (istream& s, Quadric& c)
 {
-	s >> c.surface >> c.a >> c.b >> c.c >> c.d >> c.e >> c.f >> c.g >> c.h >>
+	readmaterial(s, c.material) >> c.a >> c.b >> c.c >> c.d >> c.e >> c.f >> c.g >> c.h >>
 	c.i >> c.j;
 	return s;
 }
 
 ostream& operator << (ostream& s, Quadric& c)
 {
-	s << c.surface << c.a << "\n" << c.b << "\n" << c.c << "\n" << c.d << "\n"
+	writematerial(s, c.material) << c.a << "\n" << c.b << "\n" << c.c << "\n" << c.d << "\n"
 	<< c.e << "\n" << c.f << "\n" << c.g << "\n" << c.h << "\n" << c.i << "\n"
 	<< c.j << "\n";
 	return s;
@@ -12,7 +12,7 @@ class Sphere : public Object
 	Point center;
 
 	Sphere(void);
-	void init(Surface isurface, Point icenter, FP ira);
+	void init(int imaterial, Point icenter, FP ira);
 	Boolean icheck(Ray& aray, Interdata& id);
 	void intersect(Ray& aray, Node *nodeptr, Interdata& id);
 	Point getMin(void)
@@ -32,6 +32,45 @@ class Sphere : public Object
 istream& operator >> (istream& s, Sphere& p);
 ostream& operator << (ostream& s, Sphere& p);
 
+// (Inline, for icheckhandle() in pool.h.)
+
+inline Boolean Sphere::icheck(Ray& aray, Interdata& id)
+{
+	// Algorithm from Eric Haines in Ray Tracing. (the geometric method)
+
+	FP l2, d, tca;
+	Boolean outside = true;
+	Vector oc = center - aray.origin;
+
+	// tca is the distance from origin to closest approach to the sphere center
+	tca = oc * aray.direction;
+	l2 = oc * oc;			//  l2 is length^2 of the origin to the center vector.
+	if (l2 <= ras)
+		outside = false;	//  The ray origin is inside the sphere.
+	if ((tca < sigma) && (outside == true))
+		return false;		//  The ray won't intersect the sphere.
+	d = ras + sqr(tca) - l2;
+	if (d < sigma)
+		return false;
+	if (outside == true)
+	{
+
+		id.t = tca - sqrt(d);
+		if (fabs(id.t) < sigma)
+			id.t = tca + sqrt(d);
+	}
+	else
+	{
+		id.t = tca + sqrt(d);
+		if (fabs(id.t) < sigma)
+			return false;
+	}
+	id.poi = aray.getPoi(id.t);
+	id.normal = id.poi - center;
+	id.normal.unitize();
+	return true;
+}
+
 
 class Cylinder : public Object
 {
@@ -68,7 +107,7 @@ class Quadric : public Object
 	FP a, b, c, d, e, f, g, h, i, j;
 
 	Quadric(void);
-	void init(Surface isurface, FP ia, FP ib, FP ic, FP id, FP ie, FP iif, FP ig, FP ih, FP ii, FP ij);
+	void init(int imaterial, FP ia, FP ib, FP ic, FP id, FP ie, FP iif, FP ig, FP ih, FP ii, FP ij);
 	Boolean icheck(Ray& aray, Interdata& id);
 	void intersect(Ray& aray, Node *nodeptr, Interdata& id);
 	Point getMin(void)
@@ -1,5 +1,7 @@
 //  raytrace.cc   Started 12/25/1990  J. O'Sullivan
 
+#include <atomic>			// (Must precede raytrace.h's min & max.)
+#include <thread>
 #include "platform.h"
 #include "raytrace.h"
 #include "bmp.h"			// Windows BMP file object
@@ -11,9 +13,20 @@
 #include "planar.h"		// Planar objects
 #include "quadric.h"		// Quadric-related objects
 #include "octree.h"		// Octree-related stuff (voxels, etc.)
+#include "bvh.h"			// Bounding volume hierarchy
 #include "scene.h"		// LoadScene
+#include "tiles.h"		// The rendering threads
+#include "sampler.h"		// Jitter for supersampling
+#include "checkpoint.h"		// Saving progress, to resume later
+#include "farm.h"			// Worker processes
+#include "daemon.h"			// Serving render requests
+#include "sdb.h"			// Compiled scenes
+#include "accelcache.h"		// Octrees and BVHs saved beside their scenes
+#include "pool.h"			// icheckhandle
+#include "spheres.h"		// The leaves' spheres, in blocks
 
 #include <time.h>			// (ANSI)
+#include <sys/time.h>		// gettimeofday, for timing the build
 #include <string.h>		// (ANSI)  for strchr in main()
 #include <signal.h>		// For catching floating-point errors
 
@@ -34,12 +47,43 @@ extern "C" {
 
 // ****  Function Headers  ****
 
+void preparescene(char *sdfname, int accelopt);
 void scan(char *outfilename);
+void scanprogressive(char *outfilename);
+void renderpass(int x0, int y0, int x1, int y1);
+void developimage(void);
+void writeimage(char *outfilename);
+void interrupt(int);
+void usage(void);
+void setcheckpoint(Checkpoint& header);
+void starttiledone(void);
+void finishtile(int tile);
+void checkpointtiles(Boolean force);
+void checkpointpasses(unsigned char *lastround);
+void openoutput(char *outfilename);
+void writerow(unsigned char *row);
+void rendertile(int x0, int y0, int x1, int y1);
+void farmtile(int x0, int y0, int x1, int y1);
+long *farmstats(void);
+Color renderpixel(int x, int y);
+void renderpixels(int x, int y, int count, Color *colors);
+void storepixel(unsigned char *pixel, Color& pcolor);
+void flushstats(void);
+Color bartlett(FP xp, FP yp, Sampler& sampler);
+void renderpilots(int x0, int y0, int x1, int y1);
+Color pilotcolor(int x, int y);
+Boolean refine(int x, int y);
+Object *firsthit(Ray& aray, Interdata& idn);
 void trace(Ray aray, Node *rootptr, FP weight, int level);
+void tracehit(Ray& aray, Node *nodeptr, FP weight, int level, Object *closeptr, Interdata& idn);
+Color shade(Ray aray, FP weight, int level, Boolean entering);
+Color shadehit(Ray& aray, FP weight, int level, Boolean entering, Object *closeptr, Interdata& idn);
+Color sample(Ray& aray);
+void samplerays(Ray *rays, Color *colors, int count);
 Color illumination(Point& poi, Vector& normal);
 Color illuminate(Node *rootptr, FP weight);
-void deleteTree(Node *nodeptr, Boolean root);
 void catcher(int exceptionType, int exceptionError);
+double seconds(void);
 
 #ifdef SUNOS
 extern "C" {
@@ -59,50 +103,182 @@ extern unsigned _stklen = 32768U;	// Increase the stack size for BC.
 int maxLevel, hres, vres, numberOfObjects, numberOfLights, numberOfTextures;
 int display, storage, order, fov;
 int bytes_per_pixel, supersample, startingline, numlines;
-Object *objptr[MAXOBJ];
-Light *lightptr[16];
-Texture *textptr[256];
+Object **objptr = NULL;		// The objects, lights & textures, in tables
+Light **lightptr = NULL;		// that grow as the scene is read (see
+Texture **textptr = NULL;		// makeroom() in scene.cc)
+Surface *materials = NULL;		// The surfaces the objects share (material.cc)
+int numberOfMaterials = 0;
 Ray camera;
 Color color, acolor, backgroundColor, ambient;
 Vector scrnx, scrny, firstray, up;
 Bmp bmp;
-FP aspect, hdeflect, minlen2;
+FP aspect, hdeflect;
 FILE *outfile;
 rasterfile rfile;		// Declare an instance of the rasterfile header struct
 
-int objtype[MAXOBJ];	// Object type codes
-int textype[64];		// Texture type codes
-int lightype[16];		// Light type codes
+int *objtype = NULL;	// Object type codes
+unsigned int *objhandle = NULL;	// Object handles (see pool.h)
+int *textype = NULL;	// Texture type codes
+int *lightype = NULL;	// Light type codes
+int objectspace = 0, lightspace = 0, texturespace = 0, materialspace = 0;	// The tables' lengths
 Boolean used_by_scenebuilder = false;
 
 int threshold, numberOfVoxels = 0;
 Voxel rootvoxel;
-Boolean use_octree;
+OctreeNode *octnodes;	// The flattened octree
+unsigned int *octlist;	// Its packed object lists, as handles
+Boolean use_octree;	// True if checktree is used (octree or BVH)
+int accel = 0;		// Acceleration structure: 0 = octree, 1 = BVH
+int numberOfBVHNodes = 0;
+BVHNode *bvhnodes;
+unsigned int *bvhlist;	// Its packed object list, as handles
+Boolean singlepass = false;	// True to shade while tracing, without an intersection tree
+Boolean serial = false;		// True to render row by row on this thread alone
+int numberOfThreads = 0;		// Rendering threads (0 = one per core)
+int farm = 0;				// Worker processes to render in (0 = none)
+char *daemonpath = NULL;	// The socket to serve render requests on, if any
+Boolean scenemapped = false;	// True if the scene was loaded compiled
+int framenumber = 0;		// Keys the jitter, with the pixel and sample
+unsigned char *image;		// The image, row by row
+atomic<int> tilesdone(0);
+atomic<long> totalshadowrays(0), totalblocked(0), totalcachehits(0);	// Summed from every thread
+atomic<long> totalprimary(0);
+FP contrast = 16.0;		// Adaptive supersampling threshold (0 - 255)
+Color *pilot;			// Adaptive supersampling:  the pixels' pilot samples
+Boolean progressive = false;	// True to refine the image in passes until a limit is reached
+FP timelimit = 0.0;		// Progressive:  seconds to stop after (0 = no limit)
+int passlimit = 0;		// Progressive:  passes (samples per pixel) to stop after
+FP convergence = 0.0;		// Progressive:  average change per round to stop at
+FP flushinterval = 10.0;	// Progressive:  seconds between writing the image out
+Color *accum;			// Progressive:  the weighted sum of each pixel's samples
+int pass;				// Progressive:  the pass being rendered
+volatile sig_atomic_t interrupted = 0;	// Set by an interrupt, to stop after this pass
+FP checkpointinterval = 0.0;	// Seconds between checkpoints (0 = none)
+Boolean resume = false;		// True to carry on from the last checkpoint
+char checkpointname[140];	// outfilename.ckp
+unsigned int scenehash;		// Identifies the scene in checkpoints
+unsigned char *tiledone;	// Nonzero for each finished tile
+int tilecolumns, tilecount;	// The tiles across the image, and in all
+atomic<double> lastcheckpoint(0.0);
+
+// The progressive passes visit the 3x3 subpixels in this order, so that
+// the image is useful early on.  Their weights form the Bartlett window.
+
+static int strata[9][2] = {{1, 1}, {0, 1}, {2, 1}, {1, 0}, {1, 2},
+{0, 0}, {2, 2}, {0, 2}, {2, 0}};
+static FP strataweight[9] = {4.0, 2.0, 2.0, 2.0, 2.0, 1.0, 1.0, 1.0, 1.0};
+
+static thread_local Node rootnode;			// The root of the intersection tree
+static thread_local NodeArena nodearena;		// Intersection tree nodes below the root
+static thread_local unsigned int *lastoccluder = NULL;	// Per light, what last blocked it (a handle)
+static thread_local int occluderspace = 0;
+static thread_local long shadowrays = 0, shadowsblocked = 0, cachehits = 0;	// Shadow cache statistics
+static thread_local long primaryrays = 0;
 
 int main(int argc, char *argv[])
 {
-	char *ptr, bufs[130], outfilename[130];
-	int x;
+	char *ptr, bufs[130], outfilename[130], *sdfname = NULL, *destname = NULL;
+	int x, accelopt = -1;
+	Boolean compile = false, compiled;
 	time_t tstart, tend, tloc;
 
-	if (argc == 1)
+	// Options start with a '-'.  The first other parameter is the SDF name,
+	// and the second (if any) the destination.
+
+	for (x = 1; x < argc; x++)
+	{
+		if (strcmp(argv[x], "-bvh") == 0)
+			accelopt = 1;
+		else if (strcmp(argv[x], "-octree") == 0)
+			accelopt = 0;
+		else if (strcmp(argv[x], "-singlepass") == 0)
+			singlepass = true;
+		else if (strcmp(argv[x], "-serial") == 0)
+			serial = true;
+		else if ((strcmp(argv[x], "-threads") == 0) && (x + 1 < argc))
+			numberOfThreads = atoi(argv[++x]);
+		else if (strcmp(argv[x], "-progressive") == 0)
+			progressive = true;
+		else if ((strcmp(argv[x], "-time") == 0) && (x + 1 < argc))
+			timelimit = atof(argv[++x]);
+		else if ((strcmp(argv[x], "-passes") == 0) && (x + 1 < argc))
+			passlimit = atoi(argv[++x]);
+		else if ((strcmp(argv[x], "-converge") == 0) && (x + 1 < argc))
+			convergence = atof(argv[++x]);
+		else if ((strcmp(argv[x], "-flush") == 0) && (x + 1 < argc))
+			flushinterval = atof(argv[++x]);
+		else if ((strcmp(argv[x], "-checkpoint") == 0) && (x + 1 < argc))
+			checkpointinterval = atof(argv[++x]);
+		else if (strcmp(argv[x], "-resume") == 0)
+			resume = true;
+		else if (strcmp(argv[x], "-compile") == 0)
+			compile = true;
+		else if ((strcmp(argv[x], "-farm") == 0) && (x + 1 < argc))
+			farm = atoi(argv[++x]);
+		else if ((strcmp(argv[x], "-daemon") == 0) && (x + 1 < argc))
+			daemonpath = argv[++x];
+		else if (argv[x][0] == '-')
+		{
+			printf("Unrecognized option: %s\n", argv[x]);
+			usage();
+			exit(1);
+		}
+		else if (sdfname == NULL)
+			sdfname = argv[x];
+		else
+			destname = argv[x];
+	}
+
+	if (numberOfThreads <= 0)
+		numberOfThreads = thread::hardware_concurrency();
+	if (numberOfThreads <= 0)
+		numberOfThreads = 1;
+
+	if (daemonpath != NULL)		// Serve render requests until told to stop
 	{
-		cout << "Auto-restarting has not been implemented yet.  Call this with an SDF filename!\n\n";
+		renderdaemon(daemonpath, accelopt);
+		exit(0);
+	}
+
+	if (sdfname == NULL)
+	{
+		usage();
 		exit(1);
 	}
 
-	strcpy(bufs, argv[1]);
+	strcpy(bufs, sdfname);
 	ptr = strchr(bufs, 0);
 	if (ptr)
 		*ptr = 0;	// Terminate the string at the first space.
 
-	if (argc == 2)	// If there's only the .sdf filename, use default dest.
+	x = strlen(bufs);
+	compiled = ((x > 4) && (strcmp(&bufs[x - 4], ".sdb") == 0));
+	if (compiled == true)
+		bufs[x - 4] = 0;	// (Named as the scene description would be.)
+
+	if (destname == NULL)	// If there's only the .sdf filename, use default dest.
 		strcpy(outfilename, bufs);
+	else					// There are two parameters (the sdf & destination)
+		strcpy(outfilename, destname);
 
-	if (argc == 3)	// If there are two parameters (the sdf & destination)
-		strcpy(outfilename, argv[2]);
+	if (compile == true)	// Write the compiled scene, and stop
+	{
+		strcat(bufs, ".sdf");
+		strcat(outfilename, ".sdb");
+		numberOfTextures = 1;
+		compileScene(bufs, outfilename);
+		exit(0);
+	}
+
+	if (compiled == true)
+		strcat(bufs, ".sdb");	// A compiled scene
+	else
+		strcat(bufs, ".sdf");	// Slap on an extension on the SDF file name
 
-	strcat(bufs, ".sdf");		// Slap on an extension on the SDF file name
+	strcpy(checkpointname, outfilename);
+	strcat(checkpointname, ".ckp");
+	if ((resume == true) && (checkpointinterval <= 0.0))
+		checkpointinterval = 60.0;	// Keep checkpointing a resumed render
 
 #ifdef SUNOS
 	// Next, set up a SIGFPE handler (ingore divide by zero errors):
@@ -110,25 +286,89 @@ int main(int argc, char *argv[])
 	signal(0x0e, (void (*)(int))catcher);		// Perhaps to catch other sigs.
 #endif // SUNOS
 
+	preparescene(bufs, accelopt);
+
+	if ((farm > 0) && ((progressive == true) || (serial == true)))
+	{
+		printf("Worker processes aren't used for progressive or serial rendering.\n\n");
+		farm = 0;
+	}
+
+	if (checkpointinterval > 0.0)	// (Only checkpoints need to know the scene.)
+		scenehash = hashfile(bufs);
+	printf("Beginning the trace operation...\n\n");
+	tstart = time(&tloc);
+
+	if (progressive == true)
+		scanprogressive(outfilename);
+	else
+		scan(outfilename);
+
+	tend = time(&tloc);
+	printf("\n\nElapsed time: %ld seconds.\n\n", (tend - tstart));
+	if (totalblocked > 0)
+		printf("Shadow rays: %ld, blocked: %ld, blocked by the cached occluder: %ld (%.1f%%).\n\n",
+		(long)totalshadowrays, (long)totalblocked, (long)totalcachehits, 100.0 * totalcachehits / totalblocked);
+	printf("Primary rays: %ld (%.2f per pixel).\n\n", (long)totalprimary,
+	(FP)totalprimary / ((FP)hres * (numlines - 2 * startingline)));
+	if (display == 3)
+	{
+		printf("Press any key to exit...\n");
+		gets((char *)&bufs);
+	}
+	freeScene();
+}
+
+
+void preparescene(char *sdfname, int accelopt)
+{
+	// Load the scene, and build its octree or BVH.  accelopt is -1 unless
+	// the command line chose the acceleration structure.
+
+	int x;
+	double bstart;
+
 	numberOfTextures = 1;	// 0 = no texture
 	printf("Now loading the scene from the scene description file.\n\n");
-	loadScene(bufs);
+	loadScene(sdfname);
 
 	if (threshold == 0)
 		threshold = 16;		// Set the default threshold value.
 
 	printf("Read in %d objects.\n", numberOfObjects);
 
-	if (numberOfObjects > threshold)
+	if (accelopt != -1)
+		accel = accelopt;	// The command line overrides the SDF.
+
+	if ((numberOfObjects > threshold) && (loadaccel(sdfname) == true))
+	{
+		use_octree = true;
+		if (accel == 1)
+			printf("Mapped the BVH, which contains %d nodes, from %s.acc.\n\n", numberOfBVHNodes, sdfname);
+		else
+			printf("Mapped the octree, which contains %d voxels, from %s.acc.\n\n", numberOfVoxels, sdfname);
+	}
+	else if ((numberOfObjects > threshold) && (accel == 1))
+	{
+		use_octree = true;
+		printf("Now building the BVH...\n\n");
+
+		bstart = seconds();
+		buildBVH();
+		printf("Finished building the BVH, which contains %d nodes.\n\n", numberOfBVHNodes);
+		printf("Elapsed time: %.3f seconds.\n\n", seconds() - bstart);
+		saveaccel(sdfname);
+	}
+	else if (numberOfObjects > threshold)
 	{
 		use_octree = true;
 		printf("Now building the octree...\n\n");
 
-		tstart = time(&tloc);
+		bstart = seconds();
 		buildOctree();
 		printf("Finished building the octree, which contains %d voxels.\n\n", numberOfVoxels);
-		tend = time(&tloc);
-		printf("Elapsed time: %ld seconds.\n\n", (tend - tstart));
+		printf("Elapsed time: %.3f seconds.\n\n", seconds() - bstart);
+		saveaccel(sdfname);
 
 		if (numberOfVoxels * threshold < numberOfObjects)
 		{
@@ -138,49 +378,546 @@ int main(int argc, char *argv[])
 	}
 	else
 		use_octree = false;
+	makesphereblocks();		// (For the octree's or the BVH's leaves.)
 
-	// Delete all the space used for storing the original polygon vertices:
+	// Delete all the space used for storing the original polygon vertices
+	// (unless they're in a mapped, compiled scene):
 
-	for (x = 0; x < numberOfObjects; x++)
+	for (x = 0; (scenemapped == false) && (x < numberOfObjects); x++)
 	{
 		if (objtype[x] == 7)	// If it's a polygon
-			delete ((Polygon *)objptr[x])->vertex;
+		{
+			delete [] ((Polygon *)objptr[x])->vertex;
+			((Polygon *)objptr[x])->vertex = NULL;
+		}
 	}
+}
 
-	printf("Beginning the trace operation...\n\n");
-	tstart = time(&tloc);
 
-	scan(outfilename);
+void scan(char *outfilename)
+{
+	int x, y, band;
+	Color pcolor, pcolors[PACKETSIZE];
+	unsigned char *row;
 
-	tend = time(&tloc);
-	printf("\n\nElapsed time: %ld seconds.\n\n", (tend - tstart));
-	if (display == 3)
+	openoutput(outfilename);
+
+#ifdef SUNOS
+	if (display == 3)	// If the X11 display option is selected
 	{
-		printf("Press any key to exit...\n");
-		gets((char *)&bufs);
+		devopen(devname);
+		(*dev->clear)(hres, vres);
+		(*dev->flush)();
+	}
+#endif
+
+	if (!(image = new unsigned char[hres * vres * bytes_per_pixel]))
+	{
+		printf("\nInsufficient memory to allocate space for the image.\n");
+		exit(1);
+	}
+
+	starttiledone();
+
+	if (supersample == 3)	// Adaptive supersampling needs every pilot sample first
+	{
+		if (!(pilot = new Color[hres * vres * PILOTSAMPLES]))
+		{
+			printf("\nInsufficient memory to allocate space for the pilot samples.\n");
+			exit(1);
+		}
+		if (serial == true)
+			renderpilots(0, startingline, hres, numlines - startingline);
+	}
+
+	if (farm > 0)		// Render the tiles in worker processes
+	{
+		printf("Rendering %d x %d pixel tiles in %d worker processes...\n\n", TILESIZE, TILESIZE, farm);
+		renderfarm(farm);
+	}
+	else if (serial == false)	// Render every tile, then write the rows out
+	{
+		printf("Rendering %d x %d pixel tiles on %d threads...\n\n", TILESIZE, TILESIZE, numberOfThreads);
+		tilesdone = 0;
+		starttiles(numberOfThreads);
+		if (supersample == 3)
+			rendertiles(hres, startingline, numlines - startingline, renderpilots);
+		rendertiles(hres, startingline, numlines - startingline, rendertile);
+		printf("\n\n");
+		reporttiles();		// Show how evenly the work was shared
+		stoptiles();
+	}
+
+	for (y = startingline; y < (numlines - startingline); y++)
+	{
+		row = &image[y * hres * bytes_per_pixel];
+		band = ((y - startingline) / TILESIZE) * tilecolumns;	// Its first tile
+
+		// When rendering serially, a row is skipped only if a checkpoint
+		// had every tile across it.
+
+		for (x = 0; (x < tilecolumns) && (tiledone[band + x] != 0); x++)
+			;
+		if ((serial == true) && (x < tilecolumns))		// Render the row now
+		{
+			if ((display == 0) || (display == 3))
+				printf("Row being computed: %d    \r", (vres - y - 1));
+
+			for (x = 0; x < hres; x++)
+			{
+				if (x % PACKETSIZE == 0)	// (A packet's worth at a time.)
+					renderpixels(x, y, min(hres - x, PACKETSIZE), pcolors);
+				pcolor = pcolors[x % PACKETSIZE];
+				storepixel(&row[x * bytes_per_pixel], pcolor);
+#ifdef SUNOS
+				if (display == 3)
+				{
+					tempcolor[0] = pcolor.r / 255.0;
+					tempcolor[1] = pcolor.g / 255.0;
+					tempcolor[2] = pcolor.b / 255.0;
+					(*dev->paintr)(tempcolor, x, (vres - y - 1), x+1, (vres - y));
+				}
+#endif
+			}
+
+			// At the end of a band of tiles, they're all finished.
+
+			if ((y == numlines - startingline - 1) || ((y - startingline) % TILESIZE == TILESIZE - 1))
+			{
+				for (x = 0; x < tilecolumns; x++)
+					finishtile(band + x);
+			}
+		}
+#ifdef SUNOS
+		else if (display == 3)	// Show the finished row
+		{
+			for (x = 0; x < hres; x++)
+			{
+				tempcolor[0] = row[x * bytes_per_pixel + bytes_per_pixel - 1] / 255.0;
+				tempcolor[1] = row[x * bytes_per_pixel + bytes_per_pixel - 2] / 255.0;
+				tempcolor[2] = row[x * bytes_per_pixel + bytes_per_pixel - 3] / 255.0;
+				(*dev->paintr)(tempcolor, x, (vres - y - 1), x+1, (vres - y));
+			}
+		}
+		if (display == 3)	// If display option is selected
+			(*dev->flush)();
+#endif
+		writerow(row);
+	}
+	if (storage > 0)
+		fclose(outfile);
+
+	if (checkpointinterval > 0.0)	// The render is finished;  drop its checkpoint
+	{
+		stopcheckpoints();
+		remove(checkpointname);
 	}
+
+	flushstats();
+	delete [] image;
+	delete [] tiledone;
+	if (supersample == 3)
+		delete [] pilot;
 }
 
 
-void scan(char *outfilename)
+void scanprogressive(char *outfilename)
 {
-	Node *rootptr;
-	FP xp, yp, jx, jy;
-	int pixel, x, y, yy, sx, sy;
-	Color pcolor;
+	// Render the image in passes, each adding one jittered sample per
+	// pixel from the 3x3 Bartlett window, and write it out every
+	// flushinterval seconds.  Every nine passes complete a round, after
+	// which another round of samples is started.  Stop at the time limit,
+	// the pass limit, when a round changes the image by less than
+	// convergence on average, or when interrupted.
+
+	FP start, lastflush, change;
+	int x, firstpass = 0;
+	unsigned char *lastround;
+	Checkpoint header;
+	char *data[2];
+
+	if ((timelimit <= 0.0) && (passlimit <= 0) && (convergence <= 0.0))
+		passlimit = 9;		// With no limit given, do one round.
+
+	if (!(accum = new Color[hres * vres]) ||
+	!(image = new unsigned char[hres * vres * bytes_per_pixel]) ||
+	!(lastround = new unsigned char[hres * vres * bytes_per_pixel]))
+	{
+		printf("\nInsufficient memory to allocate space for the accumulation buffer.\n");
+		exit(1);
+	}
+	for (x = 0; x < hres * vres; x++)
+		accum[x].init(0.0, 0.0, 0.0);
+	for (x = 0; x < hres * vres * bytes_per_pixel; x++)
+		lastround[x] = 0;
+
+	if (resume == true)
+	{
+		setcheckpoint(header);
+		data[0] = (char *)accum;
+		data[1] = (char *)lastround;
+		if (readcheckpoint(checkpointname, header, data) == true)
+		{
+			firstpass = header.passes;
+			printf("Resuming from %s after pass %d.\n\n", checkpointname, firstpass);
+		}
+		else
+		{
+			printf("There's no checkpoint in %s for this render.  Starting over...\n\n", checkpointname);
+			for (x = 0; x < hres * vres; x++)
+				accum[x].init(0.0, 0.0, 0.0);
+			for (x = 0; x < hres * vres * bytes_per_pixel; x++)
+				lastround[x] = 0;
+		}
+	}
+	if (checkpointinterval > 0.0)
+		startcheckpoints(checkpointname);
+
+#ifdef SUNOS
+	if (display == 3)	// If the X11 display option is selected
+	{
+		devopen(devname);
+		(*dev->clear)(hres, vres);
+		(*dev->flush)();
+	}
+#endif
+
+	signal(SIGINT, interrupt);		// An interrupt finishes the pass and stops
+	if (serial == false)
+		starttiles(numberOfThreads);
+
+	start = lastflush = lastcheckpoint = seconds();
+	for (pass = firstpass; ; pass++)
+	{
+		if (serial == true)
+			renderpass(0, startingline, hres, numlines - startingline);
+		else
+			rendertiles(hres, startingline, numlines - startingline, renderpass);
+
+		if ((display == 0) || (display == 3))
+			printf("Pass %d finished after %.1f seconds.    \r", pass + 1, seconds() - start);
+
+		if ((passlimit > 0) && (pass + 1 >= passlimit))
+			break;
+		if ((timelimit > 0.0) && (seconds() - start >= timelimit))
+			break;
+		if (interrupted != 0)
+			break;
+
+		if ((convergence > 0.0) && (pass % 9 == 8))	// At the end of a round
+		{
+			developimage();
+			change = 0.0;
+			for (x = 0; x < hres * vres * bytes_per_pixel; x++)
+			{
+				change += abs((int)image[x] - (int)lastround[x]);
+				lastround[x] = image[x];
+			}
+			change /= (FP)hres * (numlines - 2 * startingline) * bytes_per_pixel;
+			if ((pass > 8) && (change < convergence))
+				break;
+		}
+
+		if ((flushinterval > 0.0) && (seconds() - lastflush >= flushinterval))
+		{
+			developimage();
+			writeimage(outfilename);
+			lastflush = seconds();
+		}
+
+		if ((checkpointinterval > 0.0) && (seconds() - lastcheckpoint >= checkpointinterval))
+			checkpointpasses(lastround);
+	}
+	signal(SIGINT, SIG_DFL);
+	if (serial == false)
+	{
+		printf("\n\n");
+		reporttiles();		// Show how evenly the work was shared
+		stoptiles();
+	}
+
+	printf("\n\nFinished after %d passes (samples per pixel).\n", pass + 1);
+	developimage();
+	writeimage(outfilename);
+
+	if (checkpointinterval > 0.0)	// Keep a checkpoint only if interrupted
+	{
+		if (interrupted != 0)
+			checkpointpasses(lastround);
+		stopcheckpoints();
+		if (interrupted == 0)
+			remove(checkpointname);
+	}
+	flushstats();
+	delete [] accum;
+	delete [] image;
+	delete [] lastround;
+}
+
+
+void renderpass(int x0, int y0, int x1, int y1)
+{
+	// Add one pass's sample to every pixel in the tile.  Called on every
+	// rendering thread.
+
+	FP xp, yp, jx, jy, weight;
+	int x, y, yy, sx, sy;
+	Sampler sampler;
 	Ray aray;
-	char zero = 0x0;
-	char *rfileptr, *rowptr;
-	unsigned char row[8192];
 
-	rfileptr = (char *) &rfile;
-	rowptr = (char *) &row;
+	sx = strata[pass % 9][0];
+	sy = strata[pass % 9][1];
+	weight = strataweight[pass % 9];
+
+	for (y = y0; y < y1; y++)
+	{
+		if (order == 0)
+			yy = y - (vres / 2) + 1;
+		else
+			yy = (vres / 2) - y - 1;
+		yp = yy;
 
-	if (!(rootptr = new Node))
+		for (x = x0; x < x1; x++)
+		{
+			xp = x;
+
+			// The same jittered subpixel as bartlett() uses, with
+			// each round of nine passes taking the next frame's jitter.
+
+			sampler.init(y * hres + x, framenumber + pass / 9);
+			sampler.get(sx * 3 + sy, jx, jy);
+			jx = jx * 0.333333333333 - 0.166666666667;
+			jy = jy * 0.333333333333 - 0.166666666667;
+
+			aray.init(camera.origin, firstray
+			- (scrnx * (xp + 0.166666666666667 + jx + (FP)sx * 0.33333333333))
+			- (scrny * (yp + 0.166666666666667 + jy + (FP)sy * 0.33333333333)));
+			accum[y * hres + x] = accum[y * hres + x] + (sample(aray) * weight);
+		}
+	}
+	flushstats();
+}
+
+
+void developimage(void)
+{
+	// Convert the accumulation buffer to the 8-bit image.
+
+	FP totalweight = 0.0;
+	int x, y;
+	Color pcolor;
+
+	for (x = 0; x <= pass; x++)
+		totalweight += strataweight[x % 9];
+
+	for (y = startingline; y < (numlines - startingline); y++)
+	{
+		for (x = 0; x < hres; x++)
+		{
+			pcolor = accum[y * hres + x] * (1.0 / totalweight);
+			if (pcolor.r > 255.0)
+				pcolor.r = 255.0;
+			if (pcolor.g > 255.0)
+				pcolor.g = 255.0;
+			if (pcolor.b > 255.0)
+				pcolor.b = 255.0;
+			storepixel(&image[(y * hres + x) * bytes_per_pixel], pcolor);
+		}
+	}
+}
+
+
+void writeimage(char *outfilename)
+{
+	// Write the whole image out (for progressive rendering).
+
+	char filename[130];
+	int y;
+	unsigned char *row;
+
+	strcpy(filename, outfilename);
+	openoutput(filename);
+	for (y = startingline; y < (numlines - startingline); y++)
 	{
-		printf("\nInsufficient memory to allocate space for the root node.\n");
+		row = &image[y * hres * bytes_per_pixel];
+#ifdef SUNOS
+		if (display == 3)	// Show the row
+		{
+			int x;
+
+			for (x = 0; x < hres; x++)
+			{
+				tempcolor[0] = row[x * bytes_per_pixel + bytes_per_pixel - 1] / 255.0;
+				tempcolor[1] = row[x * bytes_per_pixel + bytes_per_pixel - 2] / 255.0;
+				tempcolor[2] = row[x * bytes_per_pixel + bytes_per_pixel - 3] / 255.0;
+				(*dev->paintr)(tempcolor, x, (vres - y - 1), x+1, (vres - y));
+			}
+			(*dev->flush)();
+		}
+#endif
+		writerow(row);
+	}
+	if (storage > 0)
+		fclose(outfile);
+}
+
+
+void interrupt(int)
+{
+	interrupted = 1;
+}
+
+
+void starttiledone(void)
+{
+	// Set up the finished-tile flags, from the checkpoint if resuming,
+	// and start checkpointing.
+
+	Checkpoint header;
+	char *data[2];
+	int x;
+
+	tilecolumns = (hres + TILESIZE - 1) / TILESIZE;
+	tilecount = tilecolumns * ((numlines - 2 * startingline + TILESIZE - 1) / TILESIZE);
+	if (tilecount < 0)
+		tilecount = 0;
+	if (!(tiledone = new unsigned char[tilecount + 1]))
+	{
+		printf("\nInsufficient memory to allocate space for the tile flags.\n");
 		exit(1);
 	}
+	for (x = 0; x < tilecount; x++)
+		tiledone[x] = 0;
+
+	if (resume == true)
+	{
+		setcheckpoint(header);
+		data[0] = (char *)tiledone;
+		data[1] = (char *)image;
+		if (readcheckpoint(checkpointname, header, data) == true)
+		{
+			for (x = 0, tilesdone = 0; x < tilecount; x++)
+				tilesdone += (tiledone[x] != 0);
+			printf("Resuming from %s:  %d of %d tiles were finished.\n\n", checkpointname,
+			(int)tilesdone, tilecount);
+		}
+		else
+		{
+			printf("There's no checkpoint in %s for this render.  Starting over...\n\n", checkpointname);
+			for (x = 0; x < tilecount; x++)
+				tiledone[x] = 0;
+		}
+	}
+
+	if (checkpointinterval > 0.0)
+	{
+		startcheckpoints(checkpointname);
+		lastcheckpoint = seconds();
+	}
+}
+
+
+void finishtile(int tile)
+{
+	// Mark a tile finished, once its pixels are all in the image, and
+	// checkpoint if it's time.  Called on every rendering thread.
+
+	atomic_thread_fence(memory_order_release);
+	tiledone[tile] = 1;
+	checkpointtiles(false);
+}
+
+
+void setcheckpoint(Checkpoint& header)
+{
+	// Fill in header for a checkpoint of this render.
+
+	header.magic = CKPMAGIC;
+	header.scene = scenehash;
+	header.hres = hres;
+	header.vres = vres;
+	header.bytes_per_pixel = bytes_per_pixel;
+	header.supersample = supersample;
+	header.startingline = startingline;
+	header.numlines = numlines;
+	header.progressive = progressive;
+	header.passes = 0;
+	header.numberOfTiles = 0;
+	header.numberOfData = 2;
+	if (progressive == true)
+	{
+		header.size[0] = (long)hres * vres * sizeof(Color);
+		header.size[1] = (long)hres * vres * bytes_per_pixel;
+	}
+	else
+	{
+		header.numberOfTiles = tilecount;
+		header.size[0] = tilecount;
+		header.size[1] = (long)hres * vres * bytes_per_pixel;
+	}
+}
+
+
+void checkpointtiles(Boolean force)
+{
+	// If it's been checkpointinterval seconds since the last checkpoint
+	// (or if forced), queue one of the finished tiles.  The flags are
+	// copied before the image, so every tile flagged is in the copy.
+
+	Checkpoint header;
+	char *data[2];
+	double now, last;
+
+	if (checkpointinterval <= 0.0)
+		return;
+	now = seconds();
+	last = lastcheckpoint;
+	if ((force == false) && ((now - last < checkpointinterval) ||
+	(lastcheckpoint.compare_exchange_strong(last, now) == false)))
+		return;		// Not yet, or another thread is taking it
+
+	setcheckpoint(header);
+	data[0] = (char *)tiledone;
+	data[1] = (char *)image;
+	atomic_thread_fence(memory_order_acquire);
+	checkpoint(header, data);
+}
+
+
+void checkpointpasses(unsigned char *lastround)
+{
+	// Queue a checkpoint of the passes finished so far.
+
+	Checkpoint header;
+	char *data[2];
+
+	setcheckpoint(header);
+	header.passes = pass + 1;
+	data[0] = (char *)accum;
+	data[1] = (char *)lastround;
+	checkpoint(header, data);
+	lastcheckpoint = seconds();
+}
+
+
+void usage(void)
+{
+	printf("Usage: raytrace [-octree | -bvh] [-singlepass] [-serial | -threads n]\n");
+	printf("                [-progressive [-time s] [-passes n] [-converge d] [-flush s]]\n");
+	printf("                [-checkpoint s] [-resume] [-farm n] sdfname [destination]\n");
+	printf("       raytrace [-octree | -bvh] [-threads n] -daemon socketpath\n");
+	printf("       raytrace -compile sdfname [destination]\n\n");
+	printf("sdfname may also name a compiled scene, ending in .sdb.\n\n");
+}
+
+
+void openoutput(char *outfilename)
+{
+	// Open the output file and write its header, as selected by storage.
+
+	char *rfileptr;
+
+	rfileptr = (char *) &rfile;
 
 	if (storage == 1)	// If the image data should be stored in raw 24-bit format
 	{
@@ -232,211 +969,508 @@ void scan(char *outfilename)
 		// Write the header:
 		bmp.writeheader(outfile);
 	}
+}
 
-#ifdef SUNOS
-	if (display == 3)	// If the X11 display option is selected
+
+void writerow(unsigned char *row)
+{
+	// Write a row of pixels to the output file, padded as its format needs.
+
+	char zero = 0x0;
+
+	if (storage > 0)		// If storage is enabled
 	{
-		devopen(devname);
-		(*dev->clear)(hres, vres);
-		(*dev->flush)();
+		fwrite((char *)row, bytes_per_pixel, hres, outfile);	// Write out a row.
+		if (storage == 5)		// Windows BMP files get special treatment...
+		{
+			if (((bytes_per_pixel * hres) % 4) != 0)	// Check for 32-bit alignment
+				fwrite(&zero, 1, ((bytes_per_pixel * hres) % 4), outfile);
+		}
+		else {
+			if (((bytes_per_pixel * hres) % 2) == 1)	// If the row width is odd
+				fwrite(&zero, 1, 1, outfile);	// Write a zero to pad the row width.
+		}
 	}
-#endif
+}
 
-	srand(1);
-	for (y = startingline; y < (numlines - startingline); y++)
+
+void rendertile(int x0, int y0, int x1, int y1)
+{
+	// Render one tile into the image, unless a checkpoint had it already.
+	// Called on every rendering thread.
+
+	int x, y, done, tile;
+	Color pcolors[TILESIZE];
+
+	tile = ((y0 - startingline) / TILESIZE) * tilecolumns + x0 / TILESIZE;
+	if (tiledone[tile] != 0)
+		return;
+
+	for (y = y0; y < y1; y++)
 	{
-		if (order == 0)
-			yy = y - (vres / 2) + 1;
-		else
-			yy = (vres / 2) - y - 1;
+		renderpixels(x0, y, x1 - x0, pcolors);
+		for (x = x0; x < x1; x++)
+			storepixel(&image[(y * hres + x) * bytes_per_pixel], pcolors[x - x0]);
+	}
+	flushstats();
+	finishtile(tile);
 
-		if ((display == 0) || (display == 3))
-			printf("Row being computed: %d    \r", (vres - y - 1));
+	done = ++tilesdone;
+	if ((display == 0) || (display == 3))
+		printf("Tiles finished: %d    \r", done);
+}
 
-		yp = yy;
 
-		pixel = 0;
-		for (x = 0; x < hres; x++)
-		{
-			xp = x;
+void farmtile(int x0, int y0, int x1, int y1)
+{
+	// Render one tile into a worker process's copy of the image.
 
-			if (supersample == 0)	// No supersampling
-			{
-				rootptr->entering = true;
-				aray.init(camera.origin, firstray
-				- (scrnx * xp) - (scrny * yp));
-				trace(aray, rootptr, 1.0, 0);
-				pcolor = illuminate(rootptr, 1.0);
-				deleteTree(rootptr, true);
-			}
-			else if (supersample == 1)	// 4x supersampling
+	int x, y;
+	Color pcolors[TILESIZE];
+
+	if (supersample == 3)	// The pilot samples of the tile and the pixels around it
+		renderpilots(max(x0 - 1, 0), max(y0 - 1, startingline),
+		min(x1 + 1, hres), min(y1 + 1, numlines - startingline));
+
+	for (y = y0; y < y1; y++)
+	{
+		renderpixels(x0, y, x1 - x0, pcolors);
+		for (x = x0; x < x1; x++)
+			storepixel(&image[(y * hres + x) * bytes_per_pixel], pcolors[x - x0]);
+	}
+	flushstats();
+}
+
+
+long *farmstats(void)
+{
+	// A worker process's ray statistics, to send back to the coordinator.
+
+	static long stats[4];
+
+	stats[0] = totalshadowrays;
+	stats[1] = totalblocked;
+	stats[2] = totalcachehits;
+	stats[3] = totalprimary;
+	return stats;
+}
+
+
+static inline void clampcolor(Color& pcolor)
+{
+	// Clamp color component values to 8 bits.
+
+	if (pcolor.r > 255.0)
+		pcolor.r = 255.0;
+	if (pcolor.g > 255.0)
+		pcolor.g = 255.0;
+	if (pcolor.b > 255.0)
+		pcolor.b = 255.0;
+}
+
+
+Color renderpixel(int x, int y)
+{
+	// Compute the color of pixel (x, y), clamped to 8 bits per component.
+	// The jitter depends only on the pixel, sample and frame, so a pixel
+	// comes out the same no matter which thread renders it or when.
+
+	FP xp, yp, jx, jy;
+	int yy, sx, sy, n;
+	Sampler sampler;
+	Color pcolor, colors[4];
+	Ray aray, rays[4];
+
+	if (order == 0)
+		yy = y - (vres / 2) + 1;
+	else
+		yy = (vres / 2) - y - 1;
+
+	xp = x;
+	yp = yy;
+
+	sampler.init(y * hres + x, framenumber);
+
+	if (supersample == 0)	// No supersampling
+	{
+		aray.init(camera.origin, firstray
+		- (scrnx * xp) - (scrny * yp));
+		pcolor = sample(aray);
+	}
+	else if (supersample == 1)	// 4x supersampling
+	{
+		for (sx = 0; sx < 2; sx++)	// Subpixel x, 0 - 1
+		{
+			for (sy = 0; sy < 2; sy++)	// Subpixel y, 0 - 1
 			{
-				pcolor.init(0.0, 0.0, 0.0);
-				for (sx = 0; sx < 2; sx++)	// Subpixel x, 0 - 1
-				{
-					for (sy = 0; sy < 2; sy++)	// Subpixel y, 0 - 1
-					{
-						rootptr->entering = true;
-
-						// Next, add jitter to the ray direction.  Compute a
-						// random number between 0.0 and half-pixel-size.
-
-						// Pseudo-random #'s from -0.25 to 0.25:
-						jx = ((FP)rand() / 65535.0) - 0.25;
-						jy = ((FP)rand() / 65535.0) - 0.25;
-
-						// Add the column number, a quarter pixel or .75 pixel,
-						// and +- 0.25 pixel jitter:
-
-						aray.init(camera.origin, firstray
-						- (scrnx * (xp + 0.25 + jx + (FP)sx * 0.5))
-						- (scrny * (yp + 0.25 + jy + (FP)sy * 0.5)));
-						trace(aray, rootptr, 1.0, 0);
-						pcolor = pcolor + illuminate (rootptr, 1.0);
-						deleteTree(rootptr, true);
-					}
-				}
-				pcolor.scale(4.0);		// Average the four subpixels...
+				// Next, add jitter to the ray direction.  Compute a
+				// random number between 0.0 and half-pixel-size.
+
+				// Pseudo-random #'s from -0.25 to 0.25:
+				sampler.get(sx * 2 + sy, jx, jy);
+				jx = jx * 0.5 - 0.25;
+				jy = jy * 0.5 - 0.25;
+
+				// Add the column number, a quarter pixel or .75 pixel,
+				// and +- 0.25 pixel jitter:
+
+				rays[sx * 2 + sy].init(camera.origin, firstray
+				- (scrnx * (xp + 0.25 + jx + (FP)sx * 0.5))
+				- (scrny * (yp + 0.25 + jy + (FP)sy * 0.5)));
 			}
-			else if (supersample == 2)	// 9x (3x3) supersampling w/ Bartlett window
+		}
+		samplerays(rays, colors, 4);	// (As a packet.)
+		pcolor.init(0.0, 0.0, 0.0);
+		for (n = 0; n < 4; n++)
+			pcolor = pcolor + colors[n];
+		pcolor.scale(4.0);		// Average the four subpixels...
+	}
+	else if (supersample == 2)	// 9x (3x3) supersampling w/ Bartlett window
+		pcolor = bartlett(xp, yp, sampler);
+	else if (supersample == 3)	// Adaptive:  3x3 only where the pilot samples differ
+	{
+		if (refine(x, y) == true)
+			pcolor = bartlett(xp, yp, sampler);
+		else
+			pcolor = pilotcolor(x, y);
+	}
+
+	clampcolor(pcolor);
+	return pcolor;
+}
+
+
+void renderpixels(int x, int y, int count, Color *colors)
+{
+	// Compute the colors of count pixels along the row from (x, y), as
+	// renderpixel() does.  Without supersampling, their rays are traced
+	// PACKETSIZE at a time;  otherwise, each pixel's subpixels are.
+
+	Ray rays[PACKETSIZE];
+	int yy, n;
+
+	if (supersample != 0)
+	{
+		for (n = 0; n < count; n++)
+			colors[n] = renderpixel(x + n, y);
+		return;
+	}
+
+	if (order == 0)
+		yy = y - (vres / 2) + 1;
+	else
+		yy = (vres / 2) - y - 1;
+
+	for (; count > 0; x += PACKETSIZE, colors += PACKETSIZE, count -= PACKETSIZE)
+	{
+		for (n = 0; n < min(count, PACKETSIZE); n++)
+			rays[n].init(camera.origin, firstray
+			- (scrnx * (FP)(x + n)) - (scrny * (FP)yy));
+		samplerays(rays, colors, min(count, PACKETSIZE));
+		for (n = 0; n < min(count, PACKETSIZE); n++)
+			clampcolor(colors[n]);
+	}
+}
+
+
+Color bartlett(FP xp, FP yp, Sampler& sampler)
+{
+	// 9x (3x3) supersampling of the pixel at (xp, yp), with jitter, and
+	// a Bartlett window.
+
+	FP jx, jy;
+	int sx, sy, n;
+	Color pcolor, colors[9];
+	Ray rays[9];
+
+	// The subpixels' rays are made first, and traced in packets:
+
+	n = 0;
+	for (sx = 0; sx < 3; sx++)	// Subpixel x, 0 - 2
+	{
+		for (sy = 0; sy < 3; sy++)	// Subpixel y, 0 - 2
+		{
+			// Next, add jitter to the ray direction.  Compute a
+			// random number between 0.0 and half-pixel-size.
+
+			// # from -1/6 to 1/6:
+			sampler.get(sx * 3 + sy, jx, jy);
+			jx = jx * 0.333333333333 - 0.166666666667;
+			jy = jy * 0.333333333333 - 0.166666666667;
+
+			rays[n++].init(camera.origin, firstray
+			- (scrnx * (xp + 0.166666666666667 + jx + (FP)sx * 0.33333333333))
+			- (scrny * (yp + 0.166666666666667 + jy + (FP)sy * 0.33333333333)));
+		}
+	}
+	samplerays(rays, colors, n);
+
+	pcolor.init(0.0, 0.0, 0.0);
+	n = 0;
+	for (sx = 0; sx < 3; sx++)
+	{
+		for (sy = 0; sy < 3; sy++)
+		{
+			if ((sx == 1) && (sy == 1))
+				pcolor = pcolor + (colors[n++] * 4.0);
+			else if ((sx == 1) || (sy == 1))
+				pcolor = pcolor + (colors[n++] * 2.0);
+			else
+				pcolor = pcolor + colors[n++];
+		}
+	}
+	pcolor.scale(16.0);		// Scale back down...
+	return pcolor;
+}
+
+
+void renderpilots(int x0, int y0, int x1, int y1)
+{
+	// For adaptive supersampling, trace PILOTSAMPLES jittered rays through
+	// every pixel in the tile, on the diagonal of a 2x2 grid of subpixels.
+	// Called on every rendering thread.
+
+	int x, y, yy, n, k, count, step = PACKETSIZE / PILOTSAMPLES;
+	FP jx, jy;
+	Sampler sampler;
+	Ray rays[PACKETSIZE];
+
+	for (y = y0; y < y1; y++)
+	{
+		if (order == 0)
+			yy = y - (vres / 2) + 1;
+		else
+			yy = (vres / 2) - y - 1;
+
+		for (x = x0; x < x1; x += step)		// (Several pixels to a packet.)
+		{
+			count = min(x1 - x, step);
+			for (n = 0; n < count; n++)
 			{
-				pcolor.init(0.0, 0.0, 0.0);
-				for (sx = 0; sx < 3; sx++)	// Subpixel x, 0 - 2
+				sampler.init(y * hres + x + n, framenumber);
+				for (k = 0; k < PILOTSAMPLES; k++)
 				{
-					for (sy = 0; sy < 3; sy++)	// Subpixel y, 0 - 2
-					{
-						rootptr->entering = true;
-
-						// Next, add jitter to the ray direction.  Compute a
-						// random number between 0.0 and half-pixel-size.
-
-						// # from -1/6 to 1/6:
-						jx = ((FP)rand() / 98301.0) - 0.166666666667;
-						jy = ((FP)rand() / 98301.0) - 0.166666666667;
-
-						aray.init(camera.origin, firstray
-						- (scrnx * (xp + 0.166666666666667 + jx + (FP)sx * 0.33333333333))
-						- (scrny * (yp + 0.166666666666667 + jy + (FP)sy * 0.33333333333)));
-						trace(aray, rootptr, 1.0, 0);
-
-						if ((sx == 1) && (sy == 1))
-							pcolor = pcolor + (illuminate(rootptr, 1.0) * 4.0);
-						else if ((sx == 1) || (sy == 1))
-							pcolor = pcolor + (illuminate(rootptr, 1.0) * 2.0);
-						else
-							pcolor = pcolor + illuminate(rootptr, 1.0);
-
-						deleteTree(rootptr, true);
-					}
+					// Pseudo-random #'s from -0.25 to 0.25, as for 4x
+					// supersampling, but numbered after bartlett()'s:
+
+					sampler.get(9 + k, jx, jy);
+					jx = jx * 0.5 - 0.25;
+					jy = jy * 0.5 - 0.25;
+					rays[n * PILOTSAMPLES + k].init(camera.origin, firstray
+					- (scrnx * ((FP)(x + n) + 0.25 + jx + (FP)(k & 1) * 0.5))
+					- (scrny * ((FP)yy + 0.25 + jy + (FP)(k & 1) * 0.5)));
 				}
-				pcolor.scale(16.0);		// Scale back down...
 			}
+			samplerays(rays, &pilot[(y * hres + x) * PILOTSAMPLES], count * PILOTSAMPLES);
+		}
+	}
+	flushstats();
+}
 
-			// Next, clamp color component values to 8 bits.
-			if (pcolor.r > 255.0)
-				pcolor.r = 255.0;
-			if (pcolor.g > 255.0)
-				pcolor.g = 255.0;
-			if (pcolor.b > 255.0)
-				pcolor.b = 255.0;
 
-			if (bytes_per_pixel == 3)
-			{
-				row[pixel * 3] = (unsigned char) pcolor.b;
-				row[pixel * 3 + 1] = (unsigned char) pcolor.g;
-				row[pixel * 3 + 2] = (unsigned char) pcolor.r;
-			}
-			else
-			{
-				row[pixel * 4] = (unsigned char) 0x0;
-				row[pixel * 4 + 1] = (unsigned char) pcolor.b;
-				row[pixel * 4 + 2] = (unsigned char) pcolor.g;
-				row[pixel * 4 + 3] = (unsigned char) pcolor.r;
-			}
+static inline Boolean contrasting(Color a, Color b)
+{
+	// True if any component of a and b, clamped to 8 bits, differs by
+	// more than the contrast threshold.
 
-			pixel++;
+	return ((fabs(min(a.r, 255.0) - min(b.r, 255.0)) > contrast) ||
+	(fabs(min(a.g, 255.0) - min(b.g, 255.0)) > contrast) ||
+	(fabs(min(a.b, 255.0) - min(b.b, 255.0)) > contrast));
+}
 
-#ifdef SUNOS
-			if (display == 3)
-			{
-				tempcolor[0] = pcolor.r / 255.0;
-				tempcolor[1] = pcolor.g / 255.0;
-				tempcolor[2] = pcolor.b / 255.0;
-				(*dev->paintr)(tempcolor, x, (vres - y - 1), x+1, (vres - y));
-			}
-#endif
+
+Color pilotcolor(int x, int y)	// The average of pixel (x, y)'s pilot samples
+{
+	Color *c = &pilot[(y * hres + x) * PILOTSAMPLES], pcolor;
+	int k;
+
+	pcolor = c[0];
+	for (k = 1; k < PILOTSAMPLES; k++)
+		pcolor = pcolor + c[k];
+	pcolor.scale((FP)PILOTSAMPLES);
+	return pcolor;
+}
+
+
+Boolean refine(int x, int y)
+{
+	// True if pixel (x, y) should be supersampled:  if its pilot samples
+	// contrast with each other, or their average with any of its four
+	// neighbours'.
+
+	Color *c = &pilot[(y * hres + x) * PILOTSAMPLES], pcolor;
+	int k;
+
+	for (k = 1; k < PILOTSAMPLES; k++)
+		if (contrasting(c[0], c[k]) == true)
+			return true;
+
+	pcolor = pilotcolor(x, y);
+	if ((x > 0) && (contrasting(pcolor, pilotcolor(x - 1, y)) == true))
+		return true;
+	if ((x < hres - 1) && (contrasting(pcolor, pilotcolor(x + 1, y)) == true))
+		return true;
+	if ((y > startingline) && (contrasting(pcolor, pilotcolor(x, y - 1)) == true))
+		return true;
+	if ((y < numlines - startingline - 1) && (contrasting(pcolor, pilotcolor(x, y + 1)) == true))
+		return true;
+	return false;
+}
+
+
+void storepixel(unsigned char *pixel, Color& pcolor)
+{
+	if (bytes_per_pixel == 3)
+	{
+		pixel[0] = (unsigned char) pcolor.b;
+		pixel[1] = (unsigned char) pcolor.g;
+		pixel[2] = (unsigned char) pcolor.r;
+	}
+	else
+	{
+		pixel[0] = (unsigned char) 0x0;
+		pixel[1] = (unsigned char) pcolor.b;
+		pixel[2] = (unsigned char) pcolor.g;
+		pixel[3] = (unsigned char) pcolor.r;
+	}
+}
+
+
+void flushstats(void)
+{
+	// Add this thread's ray statistics to the totals.
+
+	totalshadowrays += shadowrays;
+	totalblocked += shadowsblocked;
+	totalcachehits += cachehits;
+	totalprimary += primaryrays;
+	shadowrays = shadowsblocked = cachehits = primaryrays = 0;
+}
+
+
+Color sample(Ray& aray)
+{
+	// Computes the color seen along a primary ray, either by building and
+	// then illuminating the intersection tree, or in a single pass.
+
+	Color c;
+
+	primaryrays++;
+	if (singlepass == true)
+		return shade(aray, 1.0, 0, true);
+
+	rootnode.entering = true;
+	trace(aray, &rootnode, 1.0, 0);
+	c = illuminate(&rootnode, 1.0);
+	nodearena.reset();	// Free the intersection tree
+	return c;
+}
+
+
+void samplerays(Ray *rays, Color *colors, int count)
+{
+	// sample() for each of count primary rays.  Given an octree or BVH,
+	// they find what they hit first PACKETSIZE at a time, with checkpacket(),
+	// and are followed from there one at a time.
+
+	Object *hits[PACKETSIZE];
+	Interdata idn[PACKETSIZE];
+	int n, k, size;
+
+	for (n = 0; n < count; n += PACKETSIZE)
+	{
+		size = min(count - n, PACKETSIZE);
+		if ((use_octree == false) || (size == 1))
+		{
+			for (k = 0; k < size; k++)
+				colors[n + k] = sample(rays[n + k]);
+			continue;
 		}
-#ifdef SUNOS
-		if (display == 3)	// If display option is selected
-			(*dev->flush)();
-#endif
-		if (storage > 0)		// If storage is enabled
-		{
-			fwrite(rowptr, bytes_per_pixel, hres, outfile);	// Write out a row.
-			if (storage == 5)		// Windows BMP files get special treatment...
-            {
-				if (((bytes_per_pixel * hres) % 4) != 0)	// Check for 32-bit alignment
-					fwrite(&zero, 1, ((bytes_per_pixel * hres) % 4), outfile);
-            }
-			else {
-				if (((bytes_per_pixel * hres) % 2) == 1)	// If the row width is odd
-					fwrite(&zero, 1, 1, outfile);	// Write a zero to pad the row width.
+
+		checkpacket(&rays[n], idn, hits, size);
+		for (k = 0; k < size; k++)
+		{
+			primaryrays++;
+			if (singlepass == true)
+				colors[n + k] = shadehit(rays[n + k], 1.0, 0, true, hits[k], idn[k]);
+			else
+			{
+				rootnode.entering = true;
+				tracehit(rays[n + k], &rootnode, 1.0, 0, hits[k], idn[k]);
+				colors[n + k] = illuminate(&rootnode, 1.0);
+				nodearena.reset();	// Free the intersection tree
 			}
 		}
 	}
-	if (storage > 0)
-		fclose(outfile);
 }
 
 
-void trace(Ray aray, Node *nodeptr, FP weight, int level)
+Object *firsthit(Ray& aray, Interdata& idn)
 {
+	// The object closest to the ray's origin that it hits (NULL if none),
+	// with idn set to where.
+
 	FP closest = 9999999999.0;  // Distance to the closest object
-	Boolean iflag = false, temp;
-	Node *tnodeptr, *rnodeptr;
-	Object *closeptr;   // pointer to the object closest to the camera
+	Boolean temp;
+	Object *closeptr = NULL;   // pointer to the object closest to the camera
 	int n;
-	Interdata id, idn;
+	Interdata id;
 
 	if (use_octree == true)
-		closeptr = checktree(aray, idn);
-	else
+		return checktree(aray, idn);
+
+	n = 0;
+	do    // Loop through all intersected objects in the scene
 	{
-		n = 0;
-		do    // Loop through all intersected objects in the scene
+		do  // Loop through all objects until an intersection is found
 		{
-			do  // Loop through all objects until an intersection is found
-			{
-				temp = objptr[n]->icheck(aray, id);
-				n++;
-			}  while ((temp == false) && (n < numberOfObjects));
+			temp = icheckhandle(objhandle[n], aray, id);
+			n++;
+		}  while ((temp == false) && (n < numberOfObjects));
 
-			// If this intersection is closer than any other, then record it.
+		// If this intersection is closer than any other, then record it.
 
-			if ((temp == true) && (id.t < closest))
-			{
-				closeptr = objptr [n-1];
-				closest = id.t;
-				idn = id;
-				iflag = true;
-			}
-		}  while (n < numberOfObjects);
-	}
+		if ((temp == true) && (id.t < closest))
+		{
+			closeptr = objptr [n-1];
+			closest = id.t;
+			idn = id;
+		}
+	}  while (n < numberOfObjects);
+	return closeptr;
+}
+
+
+void trace(Ray aray, Node *nodeptr, FP weight, int level)
+{
+	Interdata idn;
+	Object *closeptr = firsthit(aray, idn);
 
-	if (((use_octree == true) && (closeptr == NULL)) ||
-	((use_octree == false) && (iflag == false)))
+	tracehit(aray, nodeptr, weight, level, closeptr, idn);
+}
+
+
+void tracehit(Ray& aray, Node *nodeptr, FP weight, int level, Object *closeptr, Interdata& idn)
+{
+	// trace(), once the object the ray hits first is known.
+
+	Node *tnodeptr, *rnodeptr;
+
+	if (closeptr == NULL)
 	{	// No intersections - color it background.
 		nodeptr->tflag = false;
 		nodeptr->rflag = false;
-		nodeptr->surface.init(0, 1.0, 0.0, 0.0, 1.0, backgroundColor);
+		nodeptr->material = 0;		// (Diffuse only, and never textured.)
+		nodeptr->color = backgroundColor;
 		return;
 	}
 	else	// Get the intersection data
 		closeptr->intersect(aray, nodeptr, idn);
 
-	Color c = nodeptr->surface.color;	// c = the surface color computed by intersect
+	Surface& surface = materials[nodeptr->material];
+	Color c = nodeptr->color;	// c = the surface color computed by intersect
 	Color d = illumination(nodeptr->poi, nodeptr->normal);	// d is the light from the various sources
-	nodeptr->surface.color.init((ambient + d) * c);		// Compute the final point color
+	nodeptr->color.init((ambient + d) * c);		// Compute the final point color
 
 	if (level >= maxLevel)
 	{
@@ -449,17 +1483,13 @@ void trace(Ray aray, Node *nodeptr, FP weight, int level)
 	// Next, compute the weight of the transmitted ray.  If it is still
 	// significant, allocate a node and trace the transmitted ray.
 
-	if (weight * nodeptr->surface.ktran > 0.05)
+	if (weight * surface.ktran > 0.05)
 	{
-		if (!(tnodeptr = new Node))
-		{
-			printf("\nInsufficient memory to allocate a transmitted ray node.\n");
-			exit(1);
-		}
+		tnodeptr = nodearena.alloc();
 		nodeptr->tptr = tnodeptr;	// Store the pointer to the trasmitted's node
 		nodeptr->tflag = true;		// Indicate that tptr is valid.
 		tnodeptr->entering = nodeptr->entering;
-		trace(nodeptr->transmitted, tnodeptr, weight * nodeptr->surface.ktran, level+1);
+		trace(nodeptr->transmitted, tnodeptr, weight * surface.ktran, level+1);
 	}
 	else
 		nodeptr->tflag = false;
@@ -467,16 +1497,12 @@ void trace(Ray aray, Node *nodeptr, FP weight, int level)
 	// Next, compute the weight of the reflected ray.  If it is still
 	// significant, allocate a node and trace the reflected ray.
 
-	if (weight * nodeptr->surface.kspec > 0.05)
+	if (weight * surface.kspec > 0.05)
 	{
-		if (!(rnodeptr = new Node))
-		{
-			printf("\nInsufficient memory to allocate a reflected ray node.\n");
-			exit(1);
-		}
+		rnodeptr = nodearena.alloc();
 		nodeptr->rptr = rnodeptr;	// Store the pointer to the trasmitted's node
 		nodeptr->rflag = true;		// Indicate that rptr is valid.
-		trace(nodeptr->reflected, rnodeptr, weight * nodeptr->surface.kspec, level+1);
+		trace(nodeptr->reflected, rnodeptr, weight * surface.kspec, level+1);
 	}
 	else
 		nodeptr->rflag = false;
@@ -486,39 +1512,47 @@ void trace(Ray aray, Node *nodeptr, FP weight, int level)
 Color illumination(Point& poi, Vector& normal)
 {
 	Color c;
-	int l, o;
+	int l;
 	FP lt;
 	Ray aray;
-	Boolean blocked, hit;
+	Boolean blocked;
 	Interdata id;
-	Object *closeptr;
+
+	if (occluderspace < numberOfLights)		// This thread's first shadow rays
+	{
+		delete [] lastoccluder;
+		if (!(lastoccluder = new unsigned int[numberOfLights]))
+		{
+			printf("\nInsufficient memory for the shadow cache.\n");
+			exit(1);
+		}
+		for (l = 0; l < numberOfLights; l++)
+			lastoccluder[l] = 0;
+		occluderspace = numberOfLights;
+	}
 
 	for (l = 0; l < numberOfLights; l++)	// For every light, add its contribution
 	{
 		lt = aray.init(poi, lightptr[l]->location - poi);  // A ray pointing to the light
-		blocked = false;
-		if (use_octree == false)
-		{
-			o = 0;
-			do
-			{
-				do		// for every object, check for light obscuration
-				{
-					hit = objptr[o]->icheck(aray, id);
-					o++;
-				}  while ((hit == false) && (o < numberOfObjects));
 
-				if ((hit == true) && (id.t < lt))
-					blocked = true;	// An object is between the light and the poi.
-			}  while ((blocked == false) && (o < numberOfObjects));
+		// Is an object between the light and the poi?  Whatever blocked this
+		// light last time (on this thread) very likely does again, so try
+		// it before searching the scene.
+
+		shadowrays++;
+		if ((lastoccluder[l] != 0) && (icheckhandle(lastoccluder[l], aray, id) == true) &&
+		(id.t < lt))
+		{
+			blocked = true;
+			cachehits++;
 		}
 		else
 		{
-			closeptr = checktree(aray, id);
-			// If an object is hit, and it's closer than the light
-			if ((closeptr != NULL) && (id.t < lt))
-				blocked = true;
+			lastoccluder[l] = occluded(aray, lt);
+			blocked = (lastoccluder[l] != 0);
 		}
+		if (blocked == true)
+			shadowsblocked++;
 
 		if (blocked == false)	// If there are no objects blocking the light
 		{
@@ -536,36 +1570,85 @@ Color illuminate(Node *nodeptr, FP weight)
 	// of the pixel.
 
 	Color color1, color2;
+	Surface& surface = materials[nodeptr->material];
 
 	if (nodeptr->tflag == true)
 	{
-		color1 = illuminate(nodeptr->tptr, weight * nodeptr->surface.ktran);
+		color1 = illuminate(nodeptr->tptr, weight * surface.ktran);
 		color2 = color1 * weight;
 	}
 
 	if (nodeptr->rflag == true)
 	{
-		color1 = illuminate(nodeptr->rptr, weight * nodeptr->surface.kspec);
+		color1 = illuminate(nodeptr->rptr, weight * surface.kspec);
 		color2 = color2 + color1 * weight;
 	}
 
-	return (color2 + (nodeptr->surface.color * nodeptr->surface.kdiff));
+	return (color2 + (nodeptr->color * surface.kdiff));
 }
 
 
-void deleteTree(Node *nodeptr, Boolean root)
+Color shade(Ray aray, FP weight, int level, Boolean entering)
 {
-	if (nodeptr->tflag == true)
-	{
-		deleteTree(nodeptr->tptr, false);
-	}
+	// Traces a ray and returns its color in one pass:  this is trace()
+	// followed by illuminate(), with the transmitted and reflected colors
+	// weighted as soon as they come back instead of being kept in a tree.
+	// Only one node per level is needed, and it comes from the arena
+	// rather than the stack, where constructing it costs more than the
+	// tree did.  The arithmetic is done in the same order as in
+	// illuminate(), so the image is identical.
+
+	Interdata idn;
+	Object *closeptr = firsthit(aray, idn);
+
+	return shadehit(aray, weight, level, entering, closeptr, idn);
+}
 
-	if (nodeptr->rflag == true)
+
+Color shadehit(Ray& aray, FP weight, int level, Boolean entering, Object *closeptr, Interdata& idn)
+{
+	// shade(), once the object the ray hits first is known.
+
+	Node *nodeptr;
+	Color color1, color2;
+
+	if (closeptr == NULL)
+		return (color2 + backgroundColor);	// No intersections - color it background.
+
+	nodeptr = nodearena.slot(level);
+	nodeptr->entering = entering;
+	closeptr->intersect(aray, nodeptr, idn);	// Get the intersection data
+
+	Surface& surface = materials[nodeptr->material];
+	Color c = nodeptr->color;	// c = the surface color computed by intersect
+	Color d = illumination(nodeptr->poi, nodeptr->normal);	// d is the light from the various sources
+	nodeptr->color.init((ambient + d) * c);		// Compute the final point color
+
+	if (level < maxLevel)
 	{
-		deleteTree(nodeptr->rptr, false);
+		if (weight * surface.ktran > 0.05)	// Is the transmitted ray significant?
+		{
+			color1 = shade(nodeptr->transmitted, weight * surface.ktran, level+1, nodeptr->entering);
+			color2 = color1 * weight;
+		}
+
+		if (weight * surface.kspec > 0.05)	// Is the reflected ray significant?
+		{
+			color1 = shade(nodeptr->reflected, weight * surface.kspec, level+1, true);
+			color2 = color2 + color1 * weight;
+		}
 	}
 
-	if (root == false)  delete nodeptr;
+	return (color2 + (nodeptr->color * surface.kdiff));
+}
+
+
+double seconds(void)	// Wall-clock time in seconds, to the microsecond
+{
+	struct timeval tv;
+
+	gettimeofday(&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1000000.0;
 }
 
 #ifdef SUNOS
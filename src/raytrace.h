@@ -17,6 +17,7 @@ using namespace std;
 #define SIGMA 0.0000000000000001	// Used to prevent divide by zero
 //#define PI 3.14159265358979323846264383
 #define PIO2 1.570796327			// Pi divided by 2
+#define PILOTSAMPLES 2			// Adaptive supersampling:  each pixel's first samples
 #define max(a,b)	(((a)>(b))?(a):(b))
 #define min(a,b)	(((a)<(b))?(a):(b))
 
@@ -0,0 +1,52 @@
+// sampler.h	Counter-based random numbers for jittering samples
+
+#ifndef sampler_h
+#define sampler_h
+
+// The numbers come from Philox-2x32 (Salmon et al., "Parallel Random
+// Numbers: As Easy as 1, 2, 3", SC11):  ten rounds of a keyed bijection
+// applied to a counter.  Keying it by pixel and counting by sample and
+// frame means any sample's jitter can be computed on its own, on any
+// thread, in any order, and always comes out the same - there's no
+// state to share or lock.
+
+#define PHILOXM 0xd256d193U		// The round multiplier
+#define PHILOXW 0x9e3779b9U		// The key increment (golden ratio)
+
+class Sampler
+{
+	public:
+
+	unsigned int pixel;		// The key:  the pixel's number in the image
+	unsigned int frame;		// The frame (or pass) being rendered
+
+	void init(int ipixel, int iframe)
+	{
+		pixel = (unsigned int)ipixel;
+		frame = (unsigned int)iframe;
+	}
+
+	void get(int sample, FP& u, FP& v)	// Two numbers in [0, 1) for a sample
+	{
+		unsigned int c0, c1, key, hi, lo;
+		unsigned long long p;
+		int r;
+
+		c0 = (unsigned int)sample;
+		c1 = frame;
+		key = pixel;
+		for (r = 0; r < 10; r++)
+		{
+			p = (unsigned long long)PHILOXM * c0;
+			hi = (unsigned int)(p >> 32);
+			lo = (unsigned int)p;
+			c0 = hi ^ key ^ c1;
+			c1 = lo;
+			key += PHILOXW;
+		}
+		u = c0 * (1.0 / 4294967296.0);
+		v = c1 * (1.0 / 4294967296.0);
+	}
+};
+
+#endif	// Of sampler_h
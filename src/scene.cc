@@ -11,29 +11,146 @@
 #include "quadric.h"		// Quadric objects
 #include "octree.h"		// Octree stuff (voxels, etc.)
 #include "scene.h"		// Function headers & variables
+#include "sdb.h"			// Compiled scenes
+#include "parse.h"		// Reading scenes on all the cores
+#include "pool.h"		// Object pools & handles
+#include "material.h"		// finishmaterials
 #include <string.h>		// (ANSI)  for strchr in main()
 
 extern int maxLevel, hres, vres, numberOfObjects, numberOfLights, numberOfTextures;
+extern int numberOfMaterials;
 extern int display, storage, order, fov, threshold;
 extern int bytes_per_pixel, supersample, startingline, numlines;
-extern Object *objptr[MAXOBJ];
-extern Light *lightptr[16];
-extern Texture *textptr[256];
+extern Object **objptr;
+extern Light **lightptr;
+extern Texture **textptr;
+extern Surface *materials;
 extern Ray camera;
 extern Color color, acolor, backgroundColor, ambient;
 extern Vector scrnx, scrny, firstray, up;
 extern FP aspect, hdeflect, scalex, scaley;
-extern int objtype[MAXOBJ];		// Object type codes
-extern int textype[64];			// Texture type codes
-extern int lightype[16];		// Light type codes
+extern int *objtype;			// Object type codes
+extern unsigned int *objhandle;	// Object handles (see pool.h)
+extern int *textype;			// Texture type codes
+extern int *lightype;			// Light type codes
+extern int objectspace, lightspace, texturespace, materialspace;	// The tables' lengths
+extern int accel;				// Acceleration structure (0 = octree, 1 = BVH)
+extern FP contrast;				// Adaptive supersampling threshold
+
+
+Boolean setcamera(Point& location, Vector& direction)
+{
+	// Aim the camera, and work out the screen vectors from it, the field of
+	// view and the resolution.  False if it's pointed straight up or down.
+
+	Vector scrni, scrnj;
+
+	// The 'up' direction vector:
+	up.init(0.0, 1.0, 0.0);
+
+	// Initialize the camera:
+	camera.init(location, direction);
+	camera.unitize();
+
+	// The camera's field of view, in radians:
+	hdeflect = ((FP) fov) * DTOR;   // Convert to radians
+
+	// Compute the vector (scrni) at a right angle to the camera direction, pointed to the right.
+	if (vecnormcross(camera.direction, up, scrni) == 0.0)
+		return false;
+
+	// Compute the vector (scrnj) pointing up relative to the camera:
+	vecnormcross(scrni, camera.direction, scrnj);
+
+	scrnx = scrni * 2 * tan(hdeflect * 0.5) / hres;
+	scrny = scrnj * 2 * tan(hdeflect * aspect * 0.5) / vres;
+
+    // Firstray corresponds to the upper left pixel in the image.
+	firstray = camera.direction + scrni * tan(hdeflect * 0.5)
+	- scrnj * tan(hdeflect * aspect * 0.5);
+	firstray.dx = firstray.dx + SIGMA;
+	firstray.dy = firstray.dy + SIGMA;
+	return true;
+}
+
+
+static void *growtable(void *table, int length, int space, int size)
+{
+	// Table, holding length entries of size bytes, moved to space entries
+	// (the new ones NULL or 0).
+
+	void *newtable;
+
+	if (!(newtable = realloc(table, (size_t)space * size)))
+	{
+		printf("\nInsufficient memory for a table of %d entries.\n", space);
+		exit(1);
+	}
+	memset((char *)newtable + (size_t)length * size, 0, (size_t)(space - length) * size);
+	return newtable;
+}
+
+static int newspace(int space, int needed, int first)
+{
+	if (space == 0)
+		space = first;
+	while (space < needed)
+		space *= 2;
+	return space;
+}
+
+
+void makeroom(int objects, int lights, int textures, int materials)
+{
+	// Make sure there's room in the tables for this many objects, lights,
+	// textures and materials.  They double as they fill, so their size
+	// follows the scene's.
+
+	int space;
+
+	if (objects > objectspace)
+	{
+		space = newspace(objectspace, objects, 1024);
+		objptr = (Object **)growtable(objptr, objectspace, space, sizeof(Object *));
+		objtype = (int *)growtable(objtype, objectspace, space, sizeof(int));
+		objhandle = (unsigned int *)growtable(objhandle, objectspace, space, sizeof(unsigned int));
+		objectspace = space;
+	}
+	if (lights > lightspace)
+	{
+		space = newspace(lightspace, lights, 16);
+		lightptr = (Light **)growtable(lightptr, lightspace, space, sizeof(Light *));
+		lightype = (int *)growtable(lightype, lightspace, space, sizeof(int));
+		lightspace = space;
+	}
+	if (textures > texturespace)
+	{
+		space = newspace(texturespace, textures, 64);
+		textptr = (Texture **)growtable(textptr, texturespace, space, sizeof(Texture *));
+		textype = (int *)growtable(textype, texturespace, space, sizeof(int));
+		texturespace = space;
+	}
+	if (materials > materialspace)
+	{
+		space = newspace(materialspace, materials, 64);
+		::materials = (Surface *)growtable(::materials, materialspace, space, sizeof(Surface));
+		materialspace = space;
+	}
+}
 
 
 void loadScene(char *filename)
 {
-	int temp, textureType;
-	Point location;
-	Vector direction, scrni, scrnj;
 	ifstream f1;
+	int length = strlen(filename);
+
+	if ((length > 4) && (strcmp(&filename[length - 4], ".sdb") == 0))
+	{
+		mapScene(filename);		// A compiled scene
+		return;
+	}
+	if (parseScene(filename))	// Mapped, and read on all the cores
+		return;
 
 	f1.open(filename);
 	if (!f1)
@@ -41,8 +158,17 @@ void loadScene(char *filename)
 		printf("Cannot open %s for input.\n", filename);
 		exit(1);
 	}
+	readScene(f1, NULL, NULL);
+	f1.close();
+}
 
-	f1.setf(ios::skipws);	// Set I/O stream flags (skip whitespace on input)
+
+void readsettings(istream& f1)
+{
+	// Read the settings at the start of a scene description.
+
+	Point location;
+	Vector direction;
 
 	f1 >> display;		// How to display the data
 	f1 >> storage;		// Storage mode
@@ -61,38 +187,19 @@ void loadScene(char *filename)
 	f1 >> maxLevel;		// The maximum depth of the intersection tree
 	f1 >> backgroundColor;	// The color of the background
 
-	// The 'up' direction vector:
-	up.init(0.0, 1.0, 0.0);
-
-	// Initialize the camera:
-	camera.init(location, direction);
-	camera.unitize();
-
-	// The camera's field of view, in radians:
-	hdeflect = ((FP) fov) * DTOR;   // Convert to radians
-
-	// Compute the vector (scrni) at a right angle to the camera direction, pointed to the right.
-	if (vecnormcross(camera.direction, up, scrni) == 0.0)
+	if (setcamera(location, direction) == false)
 	{
 		printf("The view and up directions are identical!\n\n");
 		exit(1);
 	}
 
-	// Compute the vector (scrnj) pointing up relative to the camera:
-	vecnormcross(scrni, camera.direction, scrnj);
-
-	scrnx = scrni * 2 * tan(hdeflect * 0.5) / hres;
-	scrny = scrnj * 2 * tan(hdeflect * aspect * 0.5) / vres;
-
-    // Firstray corresponds to the upper left pixel in the image.
-	firstray = camera.direction + scrni * tan(hdeflect * 0.5)
-	- scrnj * tan(hdeflect * aspect * 0.5);
-	firstray.dx = firstray.dx + SIGMA;
-	firstray.dy = firstray.dy + SIGMA;
-
 	numberOfLights = 0;
 	numberOfObjects = 0;
 
+	makeroom(0, 0, 0, 1);
+	materials[0] = Surface();	// The background's (see trace())
+	numberOfMaterials = 1;
+
 //	numberOfTextures = 1;	// 0 = no texture, for ray tracer
 //	numberOfTextures = 0;	// for scenebuilder
 
@@ -111,6 +218,23 @@ void loadScene(char *filename)
 	else
 	if ((storage >= 3) || (storage <= 4))
 		bytes_per_pixel = 0x4;
+}
+
+
+void readScene(istream& f1, char *source, ostream *kept)
+{
+	// Read a scene description from f1.  When compiling, source is the
+	// text f1 reads, and everything but the objects is copied to kept.
+
+	int temp;
+	long start;
+	unsigned int handle;
+
+	f1.setf(ios::skipws);	// Set I/O stream flags (skip whitespace on input)
+
+	readsettings(f1);
+	if (kept != NULL)
+		kept->write(source, (long)f1.tellg());
 
 /*	Defined display codes:
 	0: Compute the data only - do not display.
@@ -131,6 +255,8 @@ void loadScene(char *filename)
 	0: No supersampling
 	1: 2 x 2 supersampling with jitter
 	2: 3 x 3 supersampling with jitter
+	3: Adaptive:  2 jittered samples per pixel, and 3 x 3 supersampling only
+	   where they contrast with each other or with the neighbours' (see 253)
 
 	Object types:
 	0: Point light source
@@ -143,6 +269,13 @@ void loadScene(char *filename)
 	7: Polygon
 	8: Plane
 	9: Ring
+	252: Material (followed by a surface, as an object's is written:  the
+	     texture, kdiff, kspec, ktran, n and the color;  the first is
+	     material 1, and an object gives -1 in place of its surface to use it)
+	253: Adaptive supersampling threshold (followed by the largest difference,
+	     0 - 255, in any color component between a pixel's samples, or
+	     neighbouring pixels', that needs no supersampling;  the default is 16)
+	254: Acceleration structure (followed by 0 = octree, 1 = BVH)
 	255: Texture
 
 	Texture types:
@@ -155,210 +288,217 @@ void loadScene(char *filename)
 
 	do
 	{
+		if (kept != NULL)
+			start = (long)f1.tellg();
 		f1 >> temp;			// Read in the object type
-		switch (temp)
+		if ((handle = newhandle(temp)) != 0)		// An object
 		{
-			case -1:
-			{
-				break;		// -1 means end of scene description.
-			}
-			case 0:			// Point light source
-			{
-				if (!(lightptr[numberOfLights] = new Plight()))
-				{
-					printf("\nInsufficient memory to allocate space for the %dth light.\n", numberOfLights);
-					exit(1);
-				}
-				f1 >> *((Plight *)lightptr[numberOfLights]);
-				lightype[numberOfLights] = 0;
-				numberOfLights++;
-				break;
-			}
-			case 1:			// sphere
-			{
-				if (!(objptr[numberOfObjects] = new Sphere()))
-				{
-					printf("\nInsufficient memory to allocate space for the %dth object (a sphere).\n", numberOfObjects);
-					exit(1);
-				}
-				f1 >> *((Sphere *)objptr[numberOfObjects]);
-				objtype[numberOfObjects] = 1;
-				numberOfObjects++;
-				break;
-			}
-			case 2:			// Box
-			{
-				if (!(objptr[numberOfObjects] = new Box()))
-				{
-					printf("\nInsufficient memory to allocate space for the %dth object (a box).\n", numberOfObjects);
-					exit(1);
-				}
-				f1 >> *((Box *)objptr[numberOfObjects]);
-				objtype[numberOfObjects] = 2;
-				numberOfObjects++;
-				break;
-			}
-			case 3:			// Orthoplane
-			{
-				if (!(objptr[numberOfObjects] = new Orthoplane()))
-				{
-					printf("\nInsufficient memory to allocate space for the %dth object (an orthoplane).\n", numberOfObjects);
-					exit(1);
-				}
-				f1 >> *((Orthoplane *)objptr[numberOfObjects]);
-				objtype[numberOfObjects] = 3;
-				numberOfObjects++;
-				break;
-			}
-			case 4:			// Cylinder
-			{
-				if (!(objptr[numberOfObjects] = new Cylinder()))
-				{
-					printf("\nInsufficient memory to allocate space for the %dth object (a cylinder).\n", numberOfObjects);
-					exit(1);
-				}
-				f1 >> *((Cylinder *)objptr[numberOfObjects]);
-				objtype[numberOfObjects] = 4;
-				numberOfObjects++;
-				break;
-			}
-			case 5:			// Quadric
-			{
-				if (!(objptr[numberOfObjects] = new Quadric()))
-				{
-					printf("\nInsufficient memory to allocate space for the %dth object (a quadric).\n", numberOfObjects);
-					exit(1);
-				}
-				f1 >> *((Quadric *)objptr[numberOfObjects]);
-				objtype[numberOfObjects] = 5;
-				numberOfObjects++;
-				break;
-			}
-			case 6:			// Directional light
-			{
-				if (!(lightptr[numberOfLights] = new Dlight()))
-				{
-					printf("\nInsufficient memory to allocate space for the %dth light.\n", numberOfLights);
-					exit(1);
-				}
-				f1 >> *((Dlight *)lightptr[numberOfLights]);
-				lightype[numberOfLights] = 6;
-				numberOfLights++;
-				break;
-			}
-			case 7:			// Polygon
+			makeroom(numberOfObjects + 1, 0, 0, 0);
+			objptr[numberOfObjects] = readobject(f1, handle);
+			objtype[numberOfObjects] = temp;
+			objhandle[numberOfObjects] = handle;
+			numberOfObjects++;
+		}
+		else
+			readrecord(f1, temp);
+
+		if ((kept != NULL) && ((temp == 0) || (temp == 6) || (temp >= 253)))
+			kept->write(&source[start], (long)f1.tellg() - start);	// Not an object
+	}  while (temp != -1);
+
+	finishmaterials();
+	checktextures();
+}
+
+
+void checktextures(void)
+{
+	int temp;
+
+	// Next, check each material for legal texture references...
+
+	for (temp = 1; temp < numberOfMaterials; temp++)
+	{
+		if (materials[temp].texture >= numberOfTextures)
+		{		// Then, the texture index is invalid - reset to no texture.
+			printf("\nError in material %d:  The texture index (%d) is invalid (>= %d).\n", temp, materials[temp].texture, numberOfTextures);
+			printf("This material will be set to no texture.\n");
+			materials[temp].texture = 0;
+		}
+	}
+}
+
+
+Object *readobject(istream& f1, unsigned int handle)
+{
+	// Read the object that handle (from newhandle()) has room for (its
+	// type code has been read).
+
+	Object *object = newobject(handle);
+
+	switch (handle >> HANDLESHIFT)
+	{
+		case 1:			// sphere
+		{
+			f1 >> *((Sphere *)object);
+			break;
+		}
+		case 2:			// Box
+		{
+			f1 >> *((Box *)object);
+			break;
+		}
+		case 3:			// Orthoplane
+		{
+			f1 >> *((Orthoplane *)object);
+			break;
+		}
+		case 4:			// Cylinder
+		{
+			f1 >> *((Cylinder *)object);
+			break;
+		}
+		case 5:			// Quadric
+		{
+			f1 >> *((Quadric *)object);
+			break;
+		}
+		case 7:			// Polygon
+		{
+			f1 >> *((Polygon *)object);
+			break;
+		}
+		case 8:			// plane
+		{
+			f1 >> *((Plane *)object);
+			break;
+		}
+		case 9:			// Ring
+		{
+			f1 >> *((Ring *)object);
+			break;
+		}
+	}
+	return object;
+}
+
+
+void readrecord(istream& f1, int type)
+{
+	// Read anything but an object:  a light, a texture or a setting (its
+	// code has been read).  -1, the end of the scene, has nothing to read.
+
+	int textureType;
+
+	makeroom(0, numberOfLights + 1, numberOfTextures + 1, numberOfMaterials + 1);
+	switch (type)
+	{
+		case -1:
+		{
+			break;		// -1 means end of scene description.
+		}
+		case 252:		// A material
+		{
+			f1 >> materials[numberOfMaterials];
+			numberOfMaterials++;
+			break;
+		}
+		case 0:			// Point light source
+		{
+			if (!(lightptr[numberOfLights] = new Plight()))
 			{
-				if (!(objptr[numberOfObjects] = new Polygon()))
-				{
-					printf("\nInsufficient memory to allocate space for the %dth object (a polygon).\n", numberOfObjects);
-					exit(1);
-				}
-				f1 >> *((Polygon *)objptr[numberOfObjects]);
-				objtype[numberOfObjects] = 7;
-				numberOfObjects++;
-				break;
+				printf("\nInsufficient memory to allocate space for the %dth light.\n", numberOfLights);
+				exit(1);
 			}
-			case 8:			// plane
+			f1 >> *((Plight *)lightptr[numberOfLights]);
+			lightype[numberOfLights] = 0;
+			numberOfLights++;
+			break;
+		}
+		case 6:			// Directional light
+		{
+			if (!(lightptr[numberOfLights] = new Dlight()))
 			{
-				if (!(objptr[numberOfObjects] = new Plane()))
-				{
-					printf("\nInsufficient memory to allocate space for the %dth object (a plane).\n", numberOfObjects);
-					exit(1);
-				}
-				f1 >> *((Plane *)objptr[numberOfObjects]);
-				objtype[numberOfObjects] = 8;
-				numberOfObjects++;
-				break;
+				printf("\nInsufficient memory to allocate space for the %dth light.\n", numberOfLights);
+				exit(1);
 			}
-			case 9:			// Ring
+			f1 >> *((Dlight *)lightptr[numberOfLights]);
+			lightype[numberOfLights] = 6;
+			numberOfLights++;
+			break;
+		}
+		case 253:		// The adaptive supersampling threshold
+		{
+			f1 >> contrast;
+			break;
+		}
+		case 254:		// The acceleration structure to use
+		{
+			f1 >> accel;
+			if ((accel < 0) || (accel > 1))
 			{
-				if (!(objptr[numberOfObjects] = new Ring()))
-				{
-					printf("\nInsufficient memory to allocate space for the %dth object (a ring).\n", numberOfObjects);
-					exit(1);
-				}
-				f1 >> *((Ring *)objptr[numberOfObjects]);
-				objtype[numberOfObjects] = 9;
-				numberOfObjects++;
-				break;
+				printf("Unrecognized acceleration structure code %d - using the octree.\n", accel);
+				accel = 0;
 			}
-			case 255:		// A Texture
+			break;
+		}
+		case 255:		// A Texture
+		{
+			f1 >> textureType;
+			switch(textureType)
 			{
-				f1 >> textureType;
-				switch(textureType)
+				case 1:	// Imagefile
 				{
-					case 1:	// Imagefile
+					if (!(textptr[numberOfTextures] = new Imagefile()))
 					{
-						if (!(textptr[numberOfTextures] = new Imagefile()))
-						{
-							printf("\nInsufficient memory to allocate space for the %dth object (an Imagefile texture).\n", numberOfTextures);
-							exit(1);
-						}
-						f1 >> *((Imagefile *)textptr[numberOfTextures]);
-						textype[numberOfTextures] = 1;
-						numberOfTextures++;
-						break;
-					}
-					case 2:	// Mandelbrot
-					{
-						if (!(textptr[numberOfTextures] = new Mandelbrot()))
-						{
-							printf("\nInsufficient memory to allocate space for the %dth object (a Mandelbrot texture).\n", numberOfTextures);
-							exit(1);
-						}
-						f1 >> *((Mandelbrot *)textptr[numberOfTextures]);
-						textype[numberOfTextures] = 2;
-						numberOfTextures++;
-						break;
+						printf("\nInsufficient memory to allocate space for the %dth object (an Imagefile texture).\n", numberOfTextures);
+						exit(1);
 					}
-					case 3:	// Tile
+					f1 >> *((Imagefile *)textptr[numberOfTextures]);
+					textype[numberOfTextures] = 1;
+					numberOfTextures++;
+					break;
+				}
+				case 2:	// Mandelbrot
+				{
+					if (!(textptr[numberOfTextures] = new Mandelbrot()))
 					{
-						if (!(textptr[numberOfTextures] = new Tile()))
-						{
-							printf("\nInsufficient memory to allocate space for the %dth object (a Tile texture).\n", numberOfTextures);
-							exit(1);
-						}
-						f1 >> *((Tile *)textptr[numberOfTextures]);
-						textype[numberOfTextures] = 3;
-						numberOfTextures++;
-						break;
+						printf("\nInsufficient memory to allocate space for the %dth object (a Mandelbrot texture).\n", numberOfTextures);
+						exit(1);
 					}
-					default:
+					f1 >> *((Mandelbrot *)textptr[numberOfTextures]);
+					textype[numberOfTextures] = 2;
+					numberOfTextures++;
+					break;
+				}
+				case 3:	// Tile
+				{
+					if (!(textptr[numberOfTextures] = new Tile()))
 					{
-						printf("There is an unrecognized texture code in the scene description file.  The code\n");
-						printf("is: %d.  The object count is: %d.  The texture count is: %d.\n\n", textureType, numberOfObjects, numberOfTextures);
-						printf("Aborting the program.\n");
+						printf("\nInsufficient memory to allocate space for the %dth object (a Tile texture).\n", numberOfTextures);
 						exit(1);
 					}
+					f1 >> *((Tile *)textptr[numberOfTextures]);
+					textype[numberOfTextures] = 3;
+					numberOfTextures++;
+					break;
+				}
+				default:
+				{
+					printf("There is an unrecognized texture code in the scene description file.  The code\n");
+					printf("is: %d.  The object count is: %d.  The texture count is: %d.\n\n", textureType, numberOfObjects, numberOfTextures);
+					printf("Aborting the program.\n");
+					exit(1);
 				}
-				break;
-			}
-			default:
-			{
-				printf("There is an unrecognized object code in the scene description file.  The code\n");
-				printf("is: %d.  The object count is: %d.  The light count is: %d.\n\n", temp, numberOfObjects, numberOfLights);
-				printf("Aborting the program.\n");
-				exit(1);
 			}
+			break;
 		}
-		if (numberOfObjects > MAXOBJ)
+		default:
 		{
-			printf("Error: the number of objects in the .sdf exceeded the allowed %d objects.\n", MAXOBJ);
-			printf("Ignoring the remaining objects...\n");
-			temp = -1;
-		}
-	}  while (temp != -1);
-	f1.close();
-
-	// Next, check each object for legal texture references...
-
-	for (temp = 0; temp < numberOfObjects; temp++)
-	{
-		if (objptr[temp]->surface.texture >= numberOfTextures)
-		{		// Then, the texture index is invalid - reset to no texture.
-			printf("\nError in object %d:  The texture index (%d) is invalid (>= %d).\n", temp, objptr[temp]->surface.texture, numberOfTextures);
-			printf("This object will be set to no texture.\n");
-			objptr[temp]->surface.texture = 0;
+			printf("There is an unrecognized object code in the scene description file.  The code\n");
+			printf("is: %d.  The object count is: %d.  The light count is: %d.\n\n", type, numberOfObjects, numberOfLights);
+			printf("Aborting the program.\n");
+			exit(1);
 		}
 	}
 }
@@ -393,6 +533,11 @@ void saveScene(char *filename)	// Write a scene to the file in filename.
 	f2 << maxLevel << "\n";	// The maximum depth of the intersection tree
 	f2 << backgroundColor;	// The color of the background
 
+	if (accel != 0)			// Only needed if it's not the octree
+		f2 << "254\n" << accel << "\n";
+	if (supersample == 3)	// Only needed for adaptive supersampling
+		f2 << "253\n" << contrast << "\n";
+
 	// Write out the lights...
 	for (temp = 0; temp < numberOfLights; temp++)
 	{
@@ -412,6 +557,10 @@ void saveScene(char *filename)	// Write a scene to the file in filename.
 		}
 	}
 
+	// Write out the materials...
+	for (temp = 1; temp < numberOfMaterials; temp++)
+		f2 << "252\n" << materials[temp];
+
 	// Write out the graphical objects...
 	for (temp = 0; temp < numberOfObjects; temp++)
 	{
@@ -3,7 +3,17 @@
 #ifndef _scene_h
 #define _scene_h
 
+class Object;
+
+void makeroom(int objects, int lights, int textures, int materials);
+Boolean setcamera(Point& location, Vector& direction);
 void loadScene(char *filename);
+void readScene(istream& f1, char *source, ostream *kept);
+void readsettings(istream& f1);
+Object *readobject(istream& f1, unsigned int handle);
+void readrecord(istream& f1, int type);
+void checktextures(void);
 void saveScene(char *filename);
+void freeScene(void);
 
 #endif	// Of scene.h
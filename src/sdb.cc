@@ -0,0 +1,554 @@
+// sdb.cc		Compiling scene description files, and mapping compiled scenes
+
+#include <sstream>			// (Must precede raytrace.h's min & max.)
+#include "platform.h"
+#include "raytrace.h"
+#include "vector.h"		// Vector-related objects and functions
+#include "miscobj.h"		// Miscellaneous objects
+#include "textures.h"	// Texture objects
+#include "object.h"		// Object abstract-class definition
+#include "planar.h"		// Planar objects
+#include "quadric.h"		// Quadric objects
+#include "scene.h"		// readScene
+#include "sdb.h"
+#include "pool.h"		// newhandle, newobject
+#include <string.h>
+#include <fcntl.h>			// open
+#include <unistd.h>			// close
+#include <sys/mman.h>		// mmap
+#include <sys/stat.h>		// fstat
+
+// A compiled scene (.sdb) file holds the scene description less its
+// objects, as text, which is read as before:  it's short, and keeps the
+// textures (with the image files they refer to) and the lights as they
+// were.  The materials follow in a section of their own, then the objects
+// in a section for each type.  A section holds each field of its objects
+// as a column of FPs, the first being each object's place in objptr (or
+// each material's in the material table).  The polygons' vertex arrays
+// are in a pool at the end of the file, and are used where they're mapped.
+//
+// Every field is stored, those worked out while the text is read too, so
+// loading an object is copying its fields.  (Objects have virtual
+// functions, so they can't be used where they're mapped.  They're made
+// in their types' pools instead.)
+
+extern int numberOfObjects, numberOfTextures, numberOfMaterials;
+extern Object **objptr;
+extern Surface *materials;
+extern int *objtype;
+extern unsigned int *objhandle;
+extern Boolean scenemapped;
+
+static char *mapping = NULL;	// The compiled scene mapped by mapScene, if any
+static long mappingsize;
+
+
+static void mix(unsigned long long *hash, void *data, long bytes)
+{
+	// Add bytes to a 64-bit FNV-1a hash.
+
+	unsigned char *p = (unsigned char *)data;
+
+	while (bytes-- > 0)
+		*hash = (*hash ^ *p++) * 1099511628211ULL;
+}
+
+
+void Sdbfields::fp(FP& value)
+{
+	FP *cell;
+
+	if (hash != NULL)
+		mix(hash, &value, sizeof(FP));
+	else if (columns != NULL)
+	{
+		cell = &columns[(long)column * count + index];
+		if (saving == true)
+			*cell = value;
+		else
+			value = *cell;
+	}
+	column++;
+}
+
+void Sdbfields::integer(int& value)
+{
+	FP temp = value;
+
+	fp(temp);
+	value = (int)temp;
+}
+
+void Sdbfields::point(Point& p)
+{
+	fp(p.x);
+	fp(p.y);
+	fp(p.z);
+}
+
+void Sdbfields::vector(Vector& v)
+{
+	fp(v.dx);
+	fp(v.dy);
+	fp(v.dz);
+}
+
+void Sdbfields::color(Color& c)
+{
+	fp(c.r);
+	fp(c.g);
+	fp(c.b);
+}
+
+void Sdbfields::array(void *&data, long bytes)
+{
+	// An array of bytes bytes, kept in the pool.  Its column holds its
+	// offset there.
+
+	FP offset = poolsize;
+
+	if (hash != NULL)		// The array itself is hashed.
+	{
+		mix(hash, data, bytes);
+		column++;
+		return;
+	}
+	if ((saving == true) && (columns != NULL))
+	{
+		if (poolsize + bytes > poolspace)
+		{
+			poolspace = max(poolspace * 2, poolsize + bytes);
+			if (!(pool = (char *)realloc(pool, poolspace)))
+			{
+				printf("\nInsufficient memory for the polygons' vertexes.\n");
+				exit(1);
+			}
+		}
+		memcpy(&pool[poolsize], data, bytes);
+		poolsize += (bytes + 7) & ~7L;	// (Keeping every array aligned.)
+	}
+	fp(offset);
+	if (saving == false)
+		data = &pool[(long)offset];
+}
+
+
+static void surfacefields(Surface& s, Sdbfields& f)
+{
+	f.fp(s.kdiff);
+	f.fp(s.kspec);
+	f.fp(s.ktran);
+	f.fp(s.n);
+	f.fp(s.in);
+	f.color(s.color);
+	f.integer(s.texture);
+}
+
+static void objectfields(int type, Object *object, Sdbfields& f)
+{
+	// Every field of an object of the given type.
+
+	int x;
+
+	f.vector(object->normal);
+	f.integer(object->material);
+
+	switch (type)
+	{
+		case 1:			// Sphere
+		{
+			Sphere *p = (Sphere *)object;
+
+			f.fp(p->ra);
+			f.fp(p->ras);
+			f.point(p->center);
+			break;
+		}
+		case 2:			// Box
+		{
+			Box *p = (Box *)object;
+
+			f.point(p->min);
+			f.point(p->max);
+			break;
+		}
+		case 3:			// Orthoplane
+		{
+			Orthoplane *p = (Orthoplane *)object;
+
+			f.fp(p->d);
+			f.point(p->min);
+			f.point(p->max);
+			break;
+		}
+		case 4:			// Cylinder
+		{
+			Cylinder *p = (Cylinder *)object;
+
+			f.fp(p->ra);
+			f.fp(p->ras);
+			f.fp(p->h);
+			f.point(p->base);
+			f.point(p->end);
+			break;
+		}
+		case 5:			// Quadric
+		{
+			Quadric *p = (Quadric *)object;
+
+			f.fp(p->a);
+			f.fp(p->b);
+			f.fp(p->c);
+			f.fp(p->d);
+			f.fp(p->e);
+			f.fp(p->f);
+			f.fp(p->g);
+			f.fp(p->h);
+			f.fp(p->i);
+			f.fp(p->j);
+			break;
+		}
+		case 7:			// Polygon
+		{
+			Polygon *p = (Polygon *)object;
+
+			f.integer(p->maxx);
+			f.integer(p->maxy);
+			f.integer(p->maxz);
+			f.fp(p->d);
+			f.integer(p->vertexes);
+			f.point(p->min);
+			f.point(p->max);
+			f.array((void *&)p->u, p->vertexes * sizeof(FP));
+			f.array((void *&)p->v, p->vertexes * sizeof(FP));
+			f.array((void *&)p->vertex, (p->vertexes + 1) * sizeof(Point));
+			break;
+		}
+		case 8:			// Plane
+		{
+			Plane *p = (Plane *)object;
+
+			f.fp(p->d);
+			for (x = 0; x < 4; x++)
+				f.point(p->p[x]);
+			f.vector(p->na);
+			f.vector(p->nb);
+			f.vector(p->nc);
+			f.fp(p->du0);
+			f.fp(p->du1);
+			f.fp(p->dv0);
+			f.fp(p->dv1);
+			f.integer(p->maxx);
+			f.integer(p->maxy);
+			f.integer(p->maxz);
+			for (x = 0; x < 4; x++)
+			{
+				f.fp(p->u[x]);
+				f.fp(p->v[x]);
+			}
+			break;
+		}
+		case 9:			// Ring
+		{
+			Ring *p = (Ring *)object;
+
+			f.point(p->center);
+			f.fp(p->innerr);
+			f.fp(p->outerr);
+			f.fp(p->d);
+			break;
+		}
+	}
+}
+
+void compileScene(char *sdfname, char *sdbname)
+{
+	// Read the scene description in sdfname, and write it to sdbname as a
+	// compiled scene.
+
+	Sdbheader header;
+	Sdbsection section[SDBMAXSECTIONS];
+	FP *columns[SDBMAXSECTIONS];
+	Sdbfields f;
+	ostringstream kept;
+	string text;
+	char *source, zero[8];
+	long length, offset, n;
+	int type, types, s, x;
+	FILE *file;
+
+	if ((file = fopen(sdfname, "rb")) == NULL)
+	{
+		printf("Cannot open %s for input.\n", sdfname);
+		exit(1);
+	}
+	fseek(file, 0, SEEK_END);
+	length = ftell(file);
+	fseek(file, 0, SEEK_SET);
+	if (!(source = new char[length + 1]))
+	{
+		printf("\nInsufficient memory to read %s.\n", sdfname);
+		exit(1);
+	}
+	length = fread(source, 1, length, file);
+	source[length] = 0;
+	fclose(file);
+
+	{
+		istringstream f1(string(source, length));
+
+		readScene(f1, source, &kept);
+	}
+	kept << "\n-1\n";
+	text = kept.str();
+	delete [] source;
+
+	f.saving = true;
+	f.hash = NULL;
+	f.pool = NULL;
+	f.poolsize = 0;
+	f.poolspace = 0;
+	header.numberOfSections = 0;
+
+	// The materials (but the background's, which every scene has).
+
+	if (numberOfMaterials > 1)
+	{
+		x = 1;
+		f.columns = NULL;
+		f.column = 0;
+		f.integer(x);
+		surfacefields(materials[x], f);
+
+		s = header.numberOfSections++;
+		section[s].type = 252;
+		section[s].columns = f.column;
+		section[s].count = numberOfMaterials - 1;
+		if (!(columns[s] = new FP[section[s].count * f.column]))
+		{
+			printf("\nInsufficient memory to compile the scene.\n");
+			exit(1);
+		}
+
+		f.columns = columns[s];
+		f.count = section[s].count;
+		for (x = 1; x < numberOfMaterials; x++)
+		{
+			f.index = x - 1;
+			f.column = 0;
+			f.integer(x);
+			surfacefields(materials[x], f);
+		}
+	}
+	types = header.numberOfSections;
+
+	// A section for each type of object in the scene, with its columns
+	// counted on its first object.
+
+	for (type = 1; type < 10; type++)
+	{
+		for (n = 0, x = 0; x < numberOfObjects; x++)
+		{
+			if (objtype[x] == type)
+				n++;
+		}
+		if (n == 0)
+			continue;
+
+		for (x = 0; objtype[x] != type; x++)
+			;
+		f.columns = NULL;
+		f.column = 0;
+		f.integer(x);
+		objectfields(type, objptr[x], f);
+
+		s = header.numberOfSections++;
+		section[s].type = type;
+		section[s].columns = f.column;
+		section[s].count = n;
+		if (!(columns[s] = new FP[n * f.column]))
+		{
+			printf("\nInsufficient memory to compile the scene.\n");
+			exit(1);
+		}
+
+		f.columns = columns[s];
+		f.count = n;
+		f.index = 0;
+		for (x = 0; x < numberOfObjects; x++)
+		{
+			if (objtype[x] != type)
+				continue;
+			f.column = 0;
+			f.integer(x);
+			objectfields(type, objptr[x], f);
+			f.index++;
+		}
+	}
+
+	// Lay the file out, keeping the columns and the pool aligned.
+
+	header.magic = SDBMAGIC;
+	header.fpsize = sizeof(FP);
+	header.numberOfObjects = numberOfObjects;
+	header.textoffset = sizeof(Sdbheader) + header.numberOfSections * sizeof(Sdbsection);
+	header.textsize = text.size();
+	offset = (header.textoffset + header.textsize + 7) & ~7L;
+	for (s = 0; s < header.numberOfSections; s++)
+	{
+		section[s].offset = offset;
+		offset += section[s].count * section[s].columns * sizeof(FP);
+	}
+	header.pooloffset = offset;
+	header.poolsize = f.poolsize;
+
+	if ((file = fopen(sdbname, "wb")) == NULL)
+	{
+		printf("Cannot open %s for output.\n", sdbname);
+		exit(1);
+	}
+	memset(zero, 0, 8);
+	fwrite(&header, sizeof(Sdbheader), 1, file);
+	fwrite(section, sizeof(Sdbsection), header.numberOfSections, file);
+	fwrite(text.data(), 1, header.textsize, file);
+	fwrite(zero, 1, (-(header.textoffset + header.textsize)) & 7L, file);
+	for (s = 0; s < header.numberOfSections; s++)
+	{
+		fwrite(columns[s], sizeof(FP), section[s].count * section[s].columns, file);
+		delete [] columns[s];
+	}
+	fwrite(f.pool, 1, f.poolsize, file);
+	if (fclose(file) != 0)
+	{
+		printf("Cannot write %s.\n", sdbname);
+		exit(1);
+	}
+	free(f.pool);
+
+	printf("Compiled %d objects, of %d types, and %d materials into %s.\n\n",
+	numberOfObjects, header.numberOfSections - types, numberOfMaterials - 1, sdbname);
+}
+
+
+void mapScene(char *filename)
+{
+	// Load a compiled scene:  map it into memory, read its text, and copy
+	// its objects' fields out of their columns.
+
+	Sdbheader *header;
+	Sdbsection *section;
+	Sdbfields f;
+	struct stat status;
+	char *base;
+	int fd, s, x;
+	long n;
+
+	if (((fd = open(filename, O_RDONLY)) < 0) || (fstat(fd, &status) != 0))
+	{
+		printf("Cannot open %s for input.\n", filename);
+		exit(1);
+	}
+	base = (char *)mmap(NULL, status.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	header = (Sdbheader *)base;
+	if ((base == (char *)MAP_FAILED) || (status.st_size < (long)sizeof(Sdbheader)) ||
+	(header->magic != SDBMAGIC) || (header->fpsize != sizeof(FP)) ||
+	(header->pooloffset + header->poolsize > status.st_size))
+	{
+		printf("%s isn't a scene compiled by this program.\n", filename);
+		exit(1);
+	}
+
+	{
+		istringstream f1(string(&base[header->textoffset], header->textsize));
+
+		readScene(f1, NULL, NULL);
+	}
+	makeroom(header->numberOfObjects, 0, 0, 0);
+
+	section = (Sdbsection *)&base[sizeof(Sdbheader)];
+	f.saving = false;
+	f.hash = NULL;
+	f.pool = &base[header->pooloffset];
+	for (s = 0; s < header->numberOfSections; s++)
+	{
+		f.columns = (FP *)&base[section[s].offset];
+		f.count = section[s].count;
+		if (section[s].type == 252)		// The materials
+		{
+			makeroom(0, 0, 0, section[s].count + 1);
+			for (n = 0; n < section[s].count; n++)
+			{
+				f.index = n;
+				f.column = 0;
+				x = 0;
+				f.integer(x);
+				if ((x < 1) || (x > section[s].count))
+				{
+					printf("%s is damaged.\n", filename);
+					exit(1);
+				}
+				surfacefields(materials[x], f);
+			}
+			numberOfMaterials = section[s].count + 1;
+			continue;
+		}
+		for (n = 0; n < section[s].count; n++)
+		{
+			f.index = n;
+			f.column = 0;
+			x = 0;
+			f.integer(x);
+			if ((x < 0) || (x >= header->numberOfObjects) ||
+			((objhandle[x] = newhandle(section[s].type)) == 0))
+			{
+				printf("%s is damaged.\n", filename);
+				exit(1);
+			}
+			objptr[x] = newobject(objhandle[x]);
+			objtype[x] = section[s].type;
+			objectfields(section[s].type, objptr[x], f);
+			if ((objptr[x]->material < 0) || (objptr[x]->material >= numberOfMaterials))
+			{
+				printf("%s is damaged.\n", filename);
+				exit(1);
+			}
+		}
+	}
+	numberOfObjects = header->numberOfObjects;
+	scenemapped = true;
+	mapping = base;
+	mappingsize = status.st_size;
+}
+
+
+void unmapScene(void)
+{
+	// Let go of the compiled scene, once its objects are freed.
+
+	if (mapping != NULL)
+		munmap(mapping, mappingsize);
+	mapping = NULL;
+	scenemapped = false;
+}
+
+
+unsigned long long hashobjects(void)
+{
+	// A hash of every object's type and fields, which changes whenever the
+	// scene's geometry does.
+
+	unsigned long long hash = 14695981039346656037ULL;
+	Sdbfields f;
+	int x;
+
+	f.hash = &hash;
+	f.columns = NULL;
+	f.saving = true;
+	for (x = 0; x < numberOfObjects; x++)
+	{
+		f.integer(objtype[x]);
+		objectfields(objtype[x], objptr[x], f);
+	}
+	return hash;
+}
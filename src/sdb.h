@@ -0,0 +1,58 @@
+// sdb.h		Compiled scenes:  scene description files turned into columns of
+//				object fields, which are mapped into memory to load them
+
+#ifndef sdb_h
+#define sdb_h
+
+#define SDBMAGIC 0x32424453		// "SDB2"
+#define SDBMAXSECTIONS 16		// One for the materials, one for each type of object
+
+class Sdbheader		// The header of a compiled scene file
+{
+	public:
+
+	int magic;
+	int fpsize;				// sizeof(FP) in the compiler
+	int numberOfObjects;
+	int numberOfSections;	// The Sdbsections that follow the header
+	long textoffset, textsize;	// The scene description, less its objects
+	long pooloffset, poolsize;	// The polygons' vertex arrays
+};
+
+class Sdbsection	// The objects of one type, a column for each field
+{
+	public:
+
+	int type;			// Their object type code
+	int columns;		// The number of fields (all stored as FP)
+	long count;			// The number of objects
+	long offset;		// Where the first column starts in the file
+};
+
+class Sdbfields		// Moves an object's fields to or from its section
+{
+	public:
+
+	FP *columns;		// The section's columns (NULL just to count them)
+	long count;			// The objects in the section
+	long index;			// The object being moved
+	int column;			// The next field's column
+	Boolean saving;		// True to store the fields, false to load them
+	unsigned long long *hash;	// If not NULL, the fields are hashed instead
+	char *pool;			// The vertex arrays
+	long poolsize, poolspace;	// Saving:  the bytes used and allocated
+
+	void fp(FP& value);
+	void integer(int& value);
+	void point(Point& p);
+	void vector(Vector& v);
+	void color(Color& c);
+	void array(void *&data, long bytes);
+};
+
+void compileScene(char *sdfname, char *sdbname);
+void mapScene(char *filename);
+void unmapScene(void);
+unsigned long long hashobjects(void);
+
+#endif	// Of sdb_h
@@ -0,0 +1,278 @@
+// spheres.cc	The spheres in the leaves, tested against a ray a block at a time
+
+#if defined(__AVX__) || defined(__SSE2__)
+#include <immintrin.h>		// (Must precede raytrace.h's min & max.)
+#endif
+#include "platform.h"
+#include "raytrace.h"
+#include "vector.h"		// Vector-related objects and functions
+#include "miscobj.h"		// Miscellaneous objects
+#include "textures.h"	// Texture objects
+#include "object.h"		// Object abstract-class definition
+#include "planar.h"		// Planar objects
+#include "quadric.h"		// Quadric objects
+#include "octree.h"		// octnodes, octlist
+#include "bvh.h"			// bvhnodes, bvhlist
+#include "pool.h"		// handleobject
+#include "spheres.h"
+
+// A leaf's object list is sorted by handle, so its spheres (type 1) come
+// first.  Once the octree or BVH is built or mapped, makesphereblocks()
+// copies each leaf's spheres into blocks of SPHERELANES, center and radius
+// squared only, so that nearestsphere() can test a ray against a block's
+// spheres at once:  with AVX if the program's compiled for it, SSE2 (two
+// at a time) if not, and one at a time failing that.  Only the sphere it
+// picks is then tested with Sphere::icheck(), for its poi and normal.
+
+extern int numberOfVoxels, numberOfBVHNodes, accel;
+extern Boolean use_octree;
+
+SphereBlock *sphereblocks;
+SphereRun *sphereruns;
+
+
+int nearestsphere(SphereBlock *blocks, int count, Ray& ray, FP tmin, FP& t)
+{
+	// The index (of count spheres) of the sphere that ray hits nearest beyond
+	// tmin, with t set to where, or -1 if it hits none there.  Each sphere is
+	// tested just as Sphere::icheck() tests it.
+
+	int s = -1, b, x;
+	FP bestt[SPHERELANES], bestindex[SPHERELANES];
+
+#if defined(__AVX__)
+	__m256d ox = _mm256_set1_pd(ray.origin.x), oy = _mm256_set1_pd(ray.origin.y);
+	__m256d oz = _mm256_set1_pd(ray.origin.z), dx = _mm256_set1_pd(ray.direction.dx);
+	__m256d dy = _mm256_set1_pd(ray.direction.dy), dz = _mm256_set1_pd(ray.direction.dz);
+	__m256d vsigma = _mm256_set1_pd(sigma), vmin = _mm256_set1_pd(tmin);
+	__m256d magnitude = _mm256_castsi256_pd(_mm256_set1_epi64x(0x7fffffffffffffffLL));
+	__m256d best = _mm256_set1_pd(HUGE_VAL), besti = _mm256_set1_pd(-1.0);
+	__m256d index = _mm256_set_pd(3.0, 2.0, 1.0, 0.0), step = _mm256_set1_pd(SPHERELANES);
+	__m256d ocx, ocy, ocz, ras, tca, l2, d, root, tnear, tfar, tv, outside, hit;
+
+	for (b = 0; b < (count + SPHERELANES - 1) / SPHERELANES; b++)
+	{
+		ocx = _mm256_sub_pd(_mm256_load_pd(blocks[b].cx), ox);
+		ocy = _mm256_sub_pd(_mm256_load_pd(blocks[b].cy), oy);
+		ocz = _mm256_sub_pd(_mm256_load_pd(blocks[b].cz), oz);
+		ras = _mm256_load_pd(blocks[b].ras);
+		tca = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, dx), _mm256_mul_pd(ocy, dy)),
+		_mm256_mul_pd(ocz, dz));
+		l2 = _mm256_add_pd(_mm256_add_pd(_mm256_mul_pd(ocx, ocx), _mm256_mul_pd(ocy, ocy)),
+		_mm256_mul_pd(ocz, ocz));
+		outside = _mm256_cmp_pd(l2, ras, _CMP_GT_OQ);
+		d = _mm256_sub_pd(_mm256_add_pd(ras, _mm256_mul_pd(tca, tca)), l2);
+		hit = _mm256_andnot_pd(_mm256_and_pd(_mm256_cmp_pd(tca, vsigma, _CMP_LT_OQ), outside),
+		_mm256_cmp_pd(d, vsigma, _CMP_GE_OQ));
+		if (_mm256_movemask_pd(hit) == 0)
+		{
+			index = _mm256_add_pd(index, step);
+			continue;	// (As it is for most blocks.)
+		}
+
+		// Outside, the near root, unless it's about 0;  inside, the far one.
+
+		root = _mm256_sqrt_pd(d);
+		tnear = _mm256_sub_pd(tca, root);
+		tfar = _mm256_add_pd(tca, root);
+		tv = _mm256_blendv_pd(tfar, tnear, _mm256_and_pd(outside,
+		_mm256_cmp_pd(_mm256_and_pd(tnear, magnitude), vsigma, _CMP_GE_OQ)));
+		hit = _mm256_and_pd(hit, _mm256_or_pd(outside,
+		_mm256_cmp_pd(_mm256_and_pd(tfar, magnitude), vsigma, _CMP_GE_OQ)));
+		hit = _mm256_and_pd(hit, _mm256_cmp_pd(tv, vmin, _CMP_GT_OQ));
+		hit = _mm256_and_pd(hit, _mm256_cmp_pd(tv, best, _CMP_LT_OQ));
+		best = _mm256_blendv_pd(best, tv, hit);
+		besti = _mm256_blendv_pd(besti, index, hit);
+		index = _mm256_add_pd(index, step);
+	}
+	_mm256_storeu_pd(bestt, best);
+	_mm256_storeu_pd(bestindex, besti);
+#elif defined(__SSE2__)
+	__m128d ox = _mm_set1_pd(ray.origin.x), oy = _mm_set1_pd(ray.origin.y);
+	__m128d oz = _mm_set1_pd(ray.origin.z), dx = _mm_set1_pd(ray.direction.dx);
+	__m128d dy = _mm_set1_pd(ray.direction.dy), dz = _mm_set1_pd(ray.direction.dz);
+	__m128d vsigma = _mm_set1_pd(sigma), vmin = _mm_set1_pd(tmin);
+	__m128d magnitude = _mm_castsi128_pd(_mm_set1_epi64x(0x7fffffffffffffffLL));
+	__m128d best[2], besti[2], index[2], step = _mm_set1_pd(SPHERELANES);
+	__m128d ocx, ocy, ocz, ras, tca, l2, d, root, tnear, tfar, tv, outside, hit, usenear;
+	int h;
+
+	// Each block is done as two halves, with the lanes' bests kept apart.
+
+	best[0] = best[1] = _mm_set1_pd(HUGE_VAL);
+	besti[0] = besti[1] = _mm_set1_pd(-1.0);
+	index[0] = _mm_set_pd(1.0, 0.0);
+	index[1] = _mm_set_pd(3.0, 2.0);
+	for (b = 0; b < (count + SPHERELANES - 1) / SPHERELANES; b++)
+	{
+		for (h = 0; h < 2; h++)
+		{
+			ocx = _mm_sub_pd(_mm_load_pd(&blocks[b].cx[2 * h]), ox);
+			ocy = _mm_sub_pd(_mm_load_pd(&blocks[b].cy[2 * h]), oy);
+			ocz = _mm_sub_pd(_mm_load_pd(&blocks[b].cz[2 * h]), oz);
+			ras = _mm_load_pd(&blocks[b].ras[2 * h]);
+			tca = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, dx), _mm_mul_pd(ocy, dy)),
+			_mm_mul_pd(ocz, dz));
+			l2 = _mm_add_pd(_mm_add_pd(_mm_mul_pd(ocx, ocx), _mm_mul_pd(ocy, ocy)),
+			_mm_mul_pd(ocz, ocz));
+			outside = _mm_cmpgt_pd(l2, ras);
+			d = _mm_sub_pd(_mm_add_pd(ras, _mm_mul_pd(tca, tca)), l2);
+			hit = _mm_andnot_pd(_mm_and_pd(_mm_cmplt_pd(tca, vsigma), outside),
+			_mm_cmpge_pd(d, vsigma));
+			if (_mm_movemask_pd(hit) != 0)
+			{
+				root = _mm_sqrt_pd(d);
+				tnear = _mm_sub_pd(tca, root);
+				tfar = _mm_add_pd(tca, root);
+				usenear = _mm_and_pd(outside, _mm_cmpge_pd(_mm_and_pd(tnear, magnitude), vsigma));
+				tv = _mm_or_pd(_mm_and_pd(usenear, tnear), _mm_andnot_pd(usenear, tfar));
+				hit = _mm_and_pd(hit, _mm_or_pd(outside,
+				_mm_cmpge_pd(_mm_and_pd(tfar, magnitude), vsigma)));
+				hit = _mm_and_pd(hit, _mm_cmpgt_pd(tv, vmin));
+				hit = _mm_and_pd(hit, _mm_cmplt_pd(tv, best[h]));
+				best[h] = _mm_or_pd(_mm_and_pd(hit, tv), _mm_andnot_pd(hit, best[h]));
+				besti[h] = _mm_or_pd(_mm_and_pd(hit, index[h]), _mm_andnot_pd(hit, besti[h]));
+			}
+			index[h] = _mm_add_pd(index[h], step);
+		}
+	}
+	_mm_storeu_pd(&bestt[0], best[0]);
+	_mm_storeu_pd(&bestt[2], best[1]);
+	_mm_storeu_pd(&bestindex[0], besti[0]);
+	_mm_storeu_pd(&bestindex[2], besti[1]);
+#else
+	FP tca, l2, d, tv, ocx, ocy, ocz;
+	Boolean outside;
+	int lane;
+
+	for (lane = 0; lane < SPHERELANES; lane++)
+	{
+		bestt[lane] = HUGE_VAL;
+		bestindex[lane] = -1.0;
+	}
+	for (b = 0; b < (count + SPHERELANES - 1) / SPHERELANES; b++)
+	{
+		for (lane = 0; lane < SPHERELANES; lane++)
+		{
+			ocx = blocks[b].cx[lane] - ray.origin.x;
+			ocy = blocks[b].cy[lane] - ray.origin.y;
+			ocz = blocks[b].cz[lane] - ray.origin.z;
+			tca = ocx * ray.direction.dx + ocy * ray.direction.dy + ocz * ray.direction.dz;
+			l2 = ocx * ocx + ocy * ocy + ocz * ocz;
+			outside = (l2 <= blocks[b].ras[lane]) ? false : true;
+			if ((tca < sigma) && (outside == true))
+				continue;
+			d = blocks[b].ras[lane] + sqr(tca) - l2;
+			if (d < sigma)
+				continue;
+			if (outside == true)
+			{
+				tv = tca - sqrt(d);
+				if (fabs(tv) < sigma)
+					tv = tca + sqrt(d);
+			}
+			else
+			{
+				tv = tca + sqrt(d);
+				if (fabs(tv) < sigma)
+					continue;
+			}
+			if ((tv > tmin) && (tv < bestt[lane]))
+			{
+				bestt[lane] = tv;
+				bestindex[lane] = b * SPHERELANES + lane;
+			}
+		}
+	}
+#endif
+
+	// The nearest of the lanes' nearest (the first sphere, if two tie):
+
+	t = HUGE_VAL;
+	for (x = 0; x < SPHERELANES; x++)
+	{
+		if ((bestindex[x] >= 0.0) && ((bestt[x] < t) || ((bestt[x] == t) && ((int)bestindex[x] < s))))
+		{
+			t = bestt[x];
+			s = (int)bestindex[x];
+		}
+	}
+	return s;
+}
+
+
+static unsigned int *leaflist(int node, int& count)
+{
+	// The object list of a leaf of the octree or BVH in use (NULL if the
+	// node isn't a leaf).
+
+	if (accel == 1)
+	{
+		count = bvhnodes[node].numberOfObjects;
+		return (count > 0) ? &bvhlist[bvhnodes[node].offset] : (unsigned int *)NULL;
+	}
+	count = octnodes[node].numberOfObjects;
+	return (count >= 0) ? &octlist[octnodes[node].offset] : (unsigned int *)NULL;
+}
+
+void makesphereblocks(void)
+{
+	// Copy the spheres each leaf's list starts with into sphereblocks, with
+	// a run in sphereruns for every node (empty for all but the leaves).
+
+	SphereBlock *block;
+	Sphere *sphere;
+	unsigned int *list;
+	int nodes, blocks = 0, node, count, n, lane;
+	void *memory;
+
+	if (use_octree == false)
+		return;
+	nodes = (accel == 1) ? numberOfBVHNodes : numberOfVoxels;
+	if (!(sphereruns = new SphereRun[(nodes > 0) ? nodes : 1]))
+	{
+		printf("\nInsufficient memory for the leaves' spheres.\n");
+		exit(1);
+	}
+	for (node = 0; node < nodes; node++)
+	{
+		n = 0;
+		if ((list = leaflist(node, count)) != NULL)
+			while ((n < count) && ((list[n] >> HANDLESHIFT) == 1))
+				n++;
+		sphereruns[node].block = blocks;
+		sphereruns[node].count = n;
+		blocks += (n + SPHERELANES - 1) / SPHERELANES;
+	}
+
+	if (posix_memalign(&memory, alignof(SphereBlock), ((blocks > 0) ? blocks : 1) * sizeof(SphereBlock)) != 0)
+	{
+		printf("\nInsufficient memory for the leaves' spheres.\n");
+		exit(1);
+	}
+	sphereblocks = (SphereBlock *)memory;	// (new[] needn't align them.)
+	for (node = 0; node < nodes; node++)
+	{
+		if (sphereruns[node].count == 0)
+			continue;
+		list = leaflist(node, count);
+		for (n = 0; n < (sphereruns[node].count + SPHERELANES - 1) / SPHERELANES * SPHERELANES; n++)
+		{
+			block = &sphereblocks[sphereruns[node].block + n / SPHERELANES];
+			lane = n % SPHERELANES;
+			if (n < sphereruns[node].count)
+			{
+				sphere = (Sphere *)handleobject(list[n]);
+				block->cx[lane] = sphere->center.x;
+				block->cy[lane] = sphere->center.y;
+				block->cz[lane] = sphere->center.z;
+				block->ras[lane] = sphere->ras;
+			}
+			else
+			{		// An unused lane:  a sphere that nothing hits.
+				block->cx[lane] = block->cy[lane] = block->cz[lane] = 0.0;
+				block->ras[lane] = -HUGE_VAL;
+			}
+		}
+	}
+}
@@ -0,0 +1,30 @@
+// spheres.h	The spheres in the leaves, tested against a ray a block at a time
+
+#ifndef spheres_h
+#define spheres_h
+
+#define SPHERELANES 4		// The spheres in a block (one AVX register of FPs)
+
+class alignas(32) SphereBlock	// Spheres, with each field in its own array
+{
+	public:
+
+	FP cx[SPHERELANES], cy[SPHERELANES], cz[SPHERELANES];	// The centers
+	FP ras[SPHERELANES];	// The radii squared (-HUGE_VAL in unused lanes)
+};
+
+class SphereRun		// The spheres a leaf's object list starts with
+{
+	public:
+
+	int block;			// The first of their blocks in sphereblocks
+	int count;			// How many spheres there are
+};
+
+extern SphereBlock *sphereblocks;
+extern SphereRun *sphereruns;	// By voxel, or by BVH node
+
+int nearestsphere(SphereBlock *blocks, int count, Ray& ray, FP tmin, FP& t);
+void makesphereblocks(void);
+
+#endif	// Of spheres_h
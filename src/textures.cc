@@ -18,6 +18,10 @@ Texture::Texture(void)
 {
 }
 
+Texture::~Texture(void)
+{
+}
+
 void Imagefile::init(char *ifilename)
 {
 	strcpy(filename, ifilename);
@@ -25,6 +25,7 @@ class Texture		// An abstract class - the mother of all textures...
 	int hres, vres;
 
 	Texture(void);
+	virtual ~Texture(void);
 	virtual Color getcolor(FP xx, FP yy) = 0;		// A pure virtual function
 };
 
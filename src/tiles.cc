@@ -0,0 +1,241 @@
+// tiles.cc		A pool of threads that share out the tiles of an image
+
+#include <thread>				// (These must precede raytrace.h's min & max.)
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include "raytrace.h"
+#include "tiles.h"
+
+// The pool is started once and kept for the life of the program.  For
+// each image, rendertiles() hands the threads a tile function and gives
+// each thread (the caller's included) an equal run of tiles.  A thread
+// renders its run from the front;  when it runs out, it steals the back
+// half of the biggest run left, which may in turn be split by the next
+// thief.  Tiles don't overlap, so the tile function can write its pixels
+// without any locking.
+
+double seconds(void);	// (In raytrace.cc)
+
+static thread **workers = NULL;		// The pool, not counting the caller
+static int numberOfWorkers = 0;
+static mutex poollock;
+static condition_variable framestart, framedone;
+static int frame = 0;			// Incremented for every image
+static int working = 0;			// Workers still busy with this image
+static Boolean quitting = false;
+
+static Tilefunction tilefunction;
+static int tilewidth, tilerow, tilelast, tilesacross, numberOfTiles;
+static Tilerun *runs = NULL;	// One per thread;  the caller's is runs[0]
+
+static inline unsigned long long packrun(unsigned int first, unsigned int last)
+{
+	return ((unsigned long long)last << 32) | first;
+}
+
+static int taketile(Tilerun& run)
+{
+	// Take the first tile of run, or return -1 if it's empty.
+
+	unsigned long long r;
+	unsigned int first, last;
+
+	r = run.range;
+	do
+	{
+		first = (unsigned int)r;
+		last = (unsigned int)(r >> 32);
+		if (first >= last)
+			return -1;
+	}  while (run.range.compare_exchange_weak(r, packrun(first + 1, last)) == false);
+	return first;
+}
+
+static Boolean stealtiles(int id)
+{
+	// Move the back half of the biggest run left to thread id's run,
+	// which is empty.  Returns false if there's nothing left to steal.
+
+	unsigned long long r, biggest;
+	unsigned int first, last, middle;
+	int x, victim;
+
+	for (;;)
+	{
+		victim = -1;
+		biggest = 0;
+		for (x = 0; x <= numberOfWorkers; x++)
+		{
+			r = runs[x].range;
+			first = (unsigned int)r;
+			last = (unsigned int)(r >> 32);
+			if ((first < last) && (last - first > biggest))
+			{
+				biggest = last - first;
+				victim = x;
+			}
+		}
+		if (victim == -1)
+			return false;
+
+		r = runs[victim].range;
+		first = (unsigned int)r;
+		last = (unsigned int)(r >> 32);
+		if (first >= last)
+			continue;
+		middle = last - (last - first + 1) / 2;
+		if (runs[victim].range.compare_exchange_strong(r, packrun(first, middle)) == true)
+		{
+			runs[id].range = packrun(middle, last);
+			runs[id].steals++;
+			return true;
+		}
+	}
+}
+
+static void worktiles(int id)
+{
+	// Render tiles until there are none left.
+
+	int t, x0, y0;
+	double start;
+
+	for (;;)
+	{
+		if ((t = taketile(runs[id])) == -1)
+		{
+			if (stealtiles(id) == false)
+				return;
+			continue;
+		}
+		x0 = (t % tilesacross) * TILESIZE;
+		y0 = tilerow + (t / tilesacross) * TILESIZE;
+
+		start = seconds();
+		tilefunction(x0, y0, min(x0 + TILESIZE, tilewidth), min(y0 + TILESIZE, tilelast));
+		runs[id].busy += seconds() - start;
+		runs[id].tiles++;
+	}
+}
+
+static void worker(int id)
+{
+	int seen = 0;
+	unique_lock<mutex> lock(poollock);
+
+	for (;;)
+	{
+		while ((frame == seen) && (quitting == false))
+			framestart.wait(lock);
+		if (quitting == true)
+			return;
+		seen = frame;
+
+		lock.unlock();
+		worktiles(id);
+		lock.lock();
+
+		if (--working == 0)
+			framedone.notify_all();
+	}
+}
+
+
+void starttiles(int threads)
+{
+	// Start threads - 1 workers;  the thread calling rendertiles() is
+	// the last one.
+
+	void *memory = NULL;
+	int x;
+
+	numberOfWorkers = threads - 1;
+	if (numberOfWorkers < 0)
+		numberOfWorkers = 0;
+	if (!(workers = new thread *[numberOfWorkers + 1]) ||
+	(posix_memalign(&memory, alignof(Tilerun), (numberOfWorkers + 1) * sizeof(Tilerun)) != 0))
+	{
+		printf("\nInsufficient memory to start the rendering threads.\n");
+		exit(1);
+	}
+	runs = (Tilerun *)memory;		// (new[] needn't align them.)
+	for (x = 0; x <= numberOfWorkers; x++)
+	{
+		new (&runs[x]) Tilerun();
+		runs[x].range = 0;
+		runs[x].busy = 0.0;
+		runs[x].tiles = 0;
+		runs[x].steals = 0;
+	}
+	for (x = 0; x < numberOfWorkers; x++)
+		workers[x] = new thread(worker, x + 1);
+}
+
+void rendertiles(int width, int firstrow, int lastrow, Tilefunction render)
+{
+	// Render rows firstrow up to lastrow, width pixels wide, and return
+	// when every tile is finished.
+
+	unique_lock<mutex> lock(poollock);
+	int x, threads;
+
+	tilefunction = render;
+	tilewidth = width;
+	tilerow = firstrow;
+	tilelast = lastrow;
+	tilesacross = (width + TILESIZE - 1) / TILESIZE;
+	numberOfTiles = tilesacross * ((lastrow - firstrow + TILESIZE - 1) / TILESIZE);
+	if (lastrow <= firstrow)
+		numberOfTiles = 0;
+
+	threads = numberOfWorkers + 1;
+	for (x = 0; x < threads; x++)
+		runs[x].range = packrun((unsigned int)((long)numberOfTiles * x / threads),
+		(unsigned int)((long)numberOfTiles * (x + 1) / threads));
+
+	working = numberOfWorkers;
+	frame++;
+	framestart.notify_all();
+	lock.unlock();
+
+	worktiles(0);
+
+	lock.lock();
+	while (working > 0)
+		framedone.wait(lock);
+}
+
+void reporttiles(void)
+{
+	// Print how long each thread spent rendering, to show how well the
+	// load was balanced.
+
+	int x;
+
+	for (x = 0; x <= numberOfWorkers; x++)
+		printf("Thread %2d: %8.3f seconds busy, %6d tiles, %4d steals.\n",
+		x, runs[x].busy, runs[x].tiles, runs[x].steals);
+}
+
+void stoptiles(void)
+{
+	int x;
+
+	{
+		lock_guard<mutex> lock(poollock);
+		quitting = true;
+		framestart.notify_all();
+	}
+	for (x = 0; x < numberOfWorkers; x++)
+	{
+		workers[x]->join();
+		delete workers[x];
+	}
+	delete [] workers;
+	free(runs);
+	workers = NULL;
+	runs = NULL;
+	numberOfWorkers = 0;
+	quitting = false;
+}
@@ -0,0 +1,29 @@
+// tiles.h		Rendering the image in square tiles on a pool of threads
+//				(Include <atomic> before raytrace.h and this.)
+
+#ifndef tiles_h
+#define tiles_h
+
+#define TILESIZE 32		// The width and height of a tile, in pixels
+
+// A tile function renders the pixels from (x0, y0) up to, but not
+// including, (x1, y1).  It is called on several threads at once.
+
+typedef void (*Tilefunction)(int x0, int y0, int x1, int y1);
+
+class alignas(64) Tilerun	// One thread's waiting tiles and statistics (a cache line each)
+{
+	public:
+
+	atomic<unsigned long long> range;	// Tiles first (low word) up to last (high word)
+	double busy;		// Seconds spent rendering tiles
+	int tiles;			// Tiles rendered
+	int steals;			// Runs taken from other threads
+};
+
+void starttiles(int threads);
+void rendertiles(int width, int firstrow, int lastrow, Tilefunction render);
+void reporttiles(void);
+void stoptiles(void);
+
+#endif	// Of tiles_h